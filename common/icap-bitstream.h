@@ -0,0 +1,200 @@
+/**
+* Bitstream formats accepted by the ICAP controllers
+*
+* The ICAP expects the words of a bitstream as 32 bit values, the sync word reads as
+* XHI_SYNC_PACKET. Besides bitstreams that are already converted to this order, the managers
+* accept the files written by Vivado directly:
+*   - .bit files, a header with the design name, part, date and time followed by the
+*     configuration data in big endian byte order
+*   - .bin files in big endian byte order (write_cfgmem/write_bitstream -bin_file)
+*   - .bin files with the bits of every byte reversed (SelectMAP bit order)
+*
+* The format is found from the first bytes of the bitstream that write_init gets: a .bit
+* header is skipped and the byte order is taken from the sync word. Everything before the
+* sync word is skipped, the ICAP does not need the dummy and bus width words.
+*
+* The words are converted in place while they are staged. Large blocks use NEON (rev32 and
+* rbit), which processes 64 bytes per iteration.
+**/
+#ifndef ICAP_BITSTREAM_H_    /* prevent circular inclusions */
+#define ICAP_BITSTREAM_H_    /* by using protection macros */
+
+#include <linux/types.h>
+#include <linux/swab.h>
+#include <linux/bitrev.h>
+#include <linux/string.h>
+#include <asm/unaligned.h>
+#ifdef CONFIG_KERNEL_MODE_NEON
+#include <asm/neon.h>
+#include <asm/simd.h>
+#endif
+
+#include "icap-packets.h"
+
+// Bytes of the bitstream write_init looks at, enough for the .bit header and the dummy words
+#define ICAP_BITSTREAM_HEADER_SIZE  1024
+
+// Words from which the conversion is worth the NEON context save
+#define ICAP_SWAP_NEON_WORDS        64
+
+enum icap_swap {
+    ICAP_SWAP_NONE,     /* already in ICAP order */
+    ICAP_SWAP_BYTES,    /* big endian words */
+    ICAP_SWAP_BITS,     /* big endian words with the bits of every byte reversed */
+};
+
+// Start of a .bit file: length 9 field, the fixed pattern and the length 1 field
+static const u8 icap_bit_magic[] = {
+    0x00, 0x09, 0x0F, 0xF0, 0x0F, 0xF0, 0x0F, 0xF0, 0x0F, 0xF0, 0x00, 0x00, 0x01
+};
+
+/**
+ * icap_bit_header_skip - Find the configuration data of a .bit file
+ * @buf:    the first bytes of the file
+ * @size:   size of buf
+ * @offset: returns the offset of the configuration data
+ *
+ * Returns 0, or -EINVAL if the header is not complete in buf. Returns 0 with offset 0
+ * if buf does not start with a .bit header.
+ **/
+static inline int icap_bit_header_skip(const u8 *buf, size_t size, size_t *offset)
+{
+    size_t pos = sizeof(icap_bit_magic);
+
+    *offset = 0;
+    if (size < pos || memcmp(buf, icap_bit_magic, pos))
+        return 0;
+
+    // Fields 'a' to 'd' have a 16 bit length, the data field 'e' a 32 bit length
+    while (pos + 3 <= size) {
+        if (buf[pos] == 'e') {
+            if (pos + 5 > size)
+                return -EINVAL;
+            *offset = pos + 5;
+            return 0;
+        }
+        if (buf[pos] < 'a' || buf[pos] > 'd')
+            return -EINVAL;
+        pos += 3 + get_unaligned_be16(buf + pos + 1);
+    }
+
+    return -EINVAL;
+}
+
+/**
+ * icap_bitstream_parse - Find the sync word and the byte order of a bitstream
+ * @buf:    the first bytes of the bitstream
+ * @size:   size of buf
+ * @offset: returns the offset of the sync word
+ * @swap:   returns the conversion the words need
+ *
+ * Returns 0, or -EINVAL for a .bit file without sync word in buf. Other bitstreams
+ * without sync word in buf are passed on unchanged.
+ **/
+static inline int icap_bitstream_parse(const u8 *buf, size_t size, size_t *offset,
+                                       enum icap_swap *swap)
+{
+    size_t data;
+    size_t pos;
+    u32 word;
+    int status;
+
+    *offset = 0;
+    *swap   = ICAP_SWAP_NONE;
+
+    status = icap_bit_header_skip(buf, size, &data);
+    if (status)
+        return status;
+
+    for (pos = data; pos + 4 <= size; pos += 4) {
+        word = get_unaligned_be32(buf + pos);
+        if (word == XHI_SYNC_PACKET)
+            *swap = ICAP_SWAP_BYTES;
+        else if (word == swab32(XHI_SYNC_PACKET))
+            *swap = ICAP_SWAP_NONE;
+        else if (word == bitrev32(swab32(XHI_SYNC_PACKET)))
+            *swap = ICAP_SWAP_BITS;
+        else
+            continue;
+
+        *offset = pos;
+        return 0;
+    }
+
+    return data ? -EINVAL : 0;
+}
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+/**
+ * icap_swap_words_neon - Convert blocks of 16 words with NEON
+ * @words:  the words, converted in place
+ * @blocks: the number of 64 byte blocks
+ * @swap:   the conversion, not ICAP_SWAP_NONE
+ *
+ * Must be called between kernel_neon_begin and kernel_neon_end. The vector registers that
+ * are used are listed as clobbered, so this does not depend on the compiler keeping nothing
+ * in them.
+ **/
+static inline void icap_swap_words_neon(u32 *words, u32 blocks, enum icap_swap swap)
+{
+    if (swap == ICAP_SWAP_BITS) {
+        asm volatile(
+            "1: ld1   {v0.16b-v3.16b}, [%0]\n"
+            "   rbit  v0.16b, v0.16b\n"
+            "   rbit  v1.16b, v1.16b\n"
+            "   rbit  v2.16b, v2.16b\n"
+            "   rbit  v3.16b, v3.16b\n"
+            "   rev32 v0.16b, v0.16b\n"
+            "   rev32 v1.16b, v1.16b\n"
+            "   rev32 v2.16b, v2.16b\n"
+            "   rev32 v3.16b, v3.16b\n"
+            "   st1   {v0.16b-v3.16b}, [%0], #64\n"
+            "   subs  %w1, %w1, #1\n"
+            "   b.ne  1b\n"
+            : "+r" (words), "+r" (blocks)
+            :
+            : "v0", "v1", "v2", "v3", "memory", "cc");
+    } else {
+        asm volatile(
+            "1: ld1   {v0.16b-v3.16b}, [%0]\n"
+            "   rev32 v0.16b, v0.16b\n"
+            "   rev32 v1.16b, v1.16b\n"
+            "   rev32 v2.16b, v2.16b\n"
+            "   rev32 v3.16b, v3.16b\n"
+            "   st1   {v0.16b-v3.16b}, [%0], #64\n"
+            "   subs  %w1, %w1, #1\n"
+            "   b.ne  1b\n"
+            : "+r" (words), "+r" (blocks)
+            :
+            : "v0", "v1", "v2", "v3", "memory", "cc");
+    }
+}
+#endif
+
+/**
+ * icap_swap_words - Convert words into the order of the ICAP
+ * @words:     the words, converted in place
+ * @num_words: the number of words
+ * @swap:      the conversion
+ **/
+static inline void icap_swap_words(u32 *words, u32 num_words, enum icap_swap swap)
+{
+    u32 i = 0;
+
+    if (swap == ICAP_SWAP_NONE)
+        return;
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+    if (num_words >= ICAP_SWAP_NEON_WORDS && may_use_simd()) {
+        kernel_neon_begin();
+        icap_swap_words_neon(words, num_words / 16, swap);
+        kernel_neon_end();
+        i = num_words & ~15;
+    }
+#endif
+
+    for (; i < num_words; i++)
+        words[i] = (swap == ICAP_SWAP_BITS) ? bitrev32(words[i]) : swab32(words[i]);
+}
+
+#endif
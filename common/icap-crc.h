@@ -0,0 +1,158 @@
+/**
+* In-flight check of the configuration CRC of a bitstream
+*
+* The ICAP computes a CRC-32C over every word that is written to a configuration register,
+* extended by the 5 bit address of the register: the 32 data bits and then the address bits
+* are shifted in LSB first. The CRC is reset by the RCRC command, and a write to the CRC
+* register compares the written value with the computed one. Bitstreams without CRC write
+* XHI_DISABLED_AUTO_CRC instead, which is not checked.
+*
+* The packets of the bitstream are parsed while they are written, so a corrupted bitstream
+* is rejected before the part with the CRC packet and the final commands reaches the ICAP.
+* The words of the data part go through the CRC32C instructions of the CPU (__crc32c_le),
+* only the address bits are shifted in by hand. The words must be in the order the ICAP
+* expects them (the sync word reads as XHI_SYNC_PACKET), encrypted bitstreams can't be checked.
+*
+* The parser also tells whether the bitstream left the ICAP desynced. Without the check, only
+* the packet headers and the commands are looked at, the data of other registers is skipped.
+**/
+#ifndef ICAP_CRC_H_    /* prevent circular inclusions */
+#define ICAP_CRC_H_    /* by using protection macros */
+
+#include <linux/types.h>
+#include <linux/crc32.h>
+#include <asm/byteorder.h>
+
+#include "icap-packets.h"
+
+// Reflected CRC-32C polynomial
+#define ICAP_CRC_POLY               0x82F63B78
+
+// Register address of a Type 1 packet header. XHI_REGISTER_MASK only covers 16 registers.
+#define ICAP_CRC_REGISTER_MASK      0x1F
+
+struct icap_crc {
+    u32 crc;            /* CRC since the last RCRC command */
+    u32 crc_reg;        /* address of the CRC register */
+    u32 cmd_reg;        /* address of the CMD register */
+    u32 reg;            /* register of the current packet */
+    u32 words;          /* data words of the current packet that are still to come */
+    bool synced;        /* the sync word was seen and no DESYNC command since */
+    bool desynced;      /* the last command was a DESYNC, no sync word since */
+    bool check;         /* the CRC is computed and checked */
+};
+
+/**
+ * icap_crc_init - Start parsing a bitstream
+ * @c:     the CRC state
+ * @regs:  addresses of the configuration registers
+ * @check: compute and check the CRC, otherwise only the sync state is followed
+ **/
+static inline void icap_crc_init(struct icap_crc *c, const struct config_registers *regs,
+                                 bool check)
+{
+    memset(c, 0, sizeof(*c));
+    c->crc_reg = regs->CRC;
+    c->cmd_reg = regs->CMD;
+    c->check   = check;
+}
+
+/**
+ * icap_crc_add - Add a register write to the CRC
+ * @crc:  the CRC
+ * @reg:  address of the register
+ * @data: the written word
+ **/
+static inline u32 icap_crc_add(u32 crc, u32 reg, u32 data)
+{
+    __le32 word = cpu_to_le32(data);
+    int i;
+
+    crc = __crc32c_le(crc, (const u8 *) &word, sizeof(word));
+    for (i = 0; i < 5; i++, reg >>= 1)
+        crc = (crc >> 1) ^ (ICAP_CRC_POLY & -((crc ^ reg) & 1));
+
+    return crc;
+}
+
+/**
+ * icap_crc_update - Parse the next words of a bitstream
+ * @c:         the CRC state
+ * @data:      the words
+ * @num_words: the number of words
+ *
+ * Returns 0 or -EBADMSG if a CRC packet does not match the words before it.
+ **/
+static inline int icap_crc_update(struct icap_crc *c, const u32 *data, u32 num_words)
+{
+    u32 word;
+    u32 op;
+    u32 n;
+
+    while (num_words > 0) {
+        // Without the check, the data of other registers than CMD is skipped at once
+        if (!c->check && c->synced && c->words > 0 && c->reg != c->cmd_reg) {
+            n = min(c->words, num_words);
+            c->words  -= n;
+            data      += n;
+            num_words -= n;
+            continue;
+        }
+
+        word = *data++;
+        num_words--;
+
+        // Dummy words and the bus width detection before the sync word are not parsed
+        if (!c->synced) {
+            c->synced = (word == XHI_SYNC_PACKET);
+            if (c->synced)
+                c->desynced = false;
+            continue;
+        }
+
+        // Data word of a register write
+        if (c->words > 0) {
+            c->words--;
+
+            if (c->reg == c->crc_reg) {
+                if (c->check && word != XHI_DISABLED_AUTO_CRC && word != c->crc)
+                    return -EBADMSG;
+                continue;
+            }
+
+            if (c->check)
+                c->crc = icap_crc_add(c->crc, c->reg, word);
+
+            if (c->reg == c->cmd_reg && word == XHI_CMD_RCRC) {
+                c->crc = 0;
+            }
+            else if (c->reg == c->cmd_reg && word == XHI_CMD_DESYNCH) {
+                c->synced   = false;
+                c->desynced = true;
+            }
+            continue;
+        }
+
+        // Packet header, only writes are followed by data words
+        op = (word >> XHI_OP_SHIFT) & XHI_OP_MASK;
+
+        switch ((word >> XHI_TYPE_SHIFT) & XHI_TYPE_MASK) {
+        case XHI_TYPE_1:
+            c->reg = (word >> XHI_REGISTER_SHIFT) & ICAP_CRC_REGISTER_MASK;
+            if (op == XHI_OP_WRITE)
+                c->words = word & XHI_WORD_COUNT_MASK_TYPE_1;
+            break;
+        case XHI_TYPE_2:
+            // Continues the register of the last Type 1 packet
+            if (op == XHI_OP_WRITE)
+                c->words = word & XHI_TYPE2_CNT_MASK;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,155 @@
+/**
+* Configuration packets of the ICAP of UltraScale+ devices
+*
+* Both ICAP controllers send the same packets to the ICAP. The definitions are taken from the
+* original Xilinx HWICAP character device driver, see UG570 for the packet format.
+**/
+#ifndef ICAP_PACKETS_H_    /* prevent circular inclusions */
+#define ICAP_PACKETS_H_    /* by using protection macros */
+
+#include <linux/types.h>
+
+/************ Constant Definitions *************/
+
+#define XHI_PAD_FRAMES              0x1
+#define XHI_FRAME_WORDS             93      /* words of a configuration frame */
+
+/* Mask for calculating configuration packet headers */
+#define XHI_WORD_COUNT_MASK_TYPE_1  0x7FFUL
+#define XHI_WORD_COUNT_MASK_TYPE_2  0x1FFFFFUL
+#define XHI_TYPE_MASK               0x7
+#define XHI_REGISTER_MASK           0xF
+#define XHI_OP_MASK                 0x3
+
+#define XHI_TYPE_SHIFT              29
+#define XHI_REGISTER_SHIFT          13
+#define XHI_OP_SHIFT                27
+
+#define XHI_TYPE_1                  1
+#define XHI_TYPE_2                  2
+#define XHI_OP_WRITE                2
+#define XHI_OP_READ                 1
+
+/* Address Block Types, in bits 25:23 of the FAR on 7 series and UltraScale(+) */
+#define XHI_FAR_BLOCK_SHIFT         23
+#define XHI_FAR_BLOCK_MASK          0x7
+#define XHI_FAR_CLB_BLOCK           0
+#define XHI_FAR_BRAM_BLOCK          1
+#define XHI_FAR_BRAM_INT_BLOCK      2
+
+struct config_registers {
+    u32 CRC;
+    u32 FAR;
+    u32 FDRI;
+    u32 FDRO;
+    u32 CMD;
+    u32 CTL;
+    u32 MASK;
+    u32 STAT;
+    u32 LOUT;
+    u32 COR;
+    u32 MFWR;
+    u32 FLR;
+    u32 KEY;
+    u32 CBC;
+    u32 IDCODE;
+    u32 AXSS;
+    u32 C0R_1;
+    u32 CSOB;
+    u32 WBSTAR;
+    u32 TIMER;
+    u32 BOOTSTS;
+    u32 CTL_1;
+};
+
+/* Configuration Commands */
+#define XHI_CMD_NULL                0
+#define XHI_CMD_WCFG                1
+#define XHI_CMD_MFW                 2
+#define XHI_CMD_DGHIGH              3
+#define XHI_CMD_RCFG                4
+#define XHI_CMD_START               5
+#define XHI_CMD_RCAP                6
+#define XHI_CMD_RCRC                7
+#define XHI_CMD_AGHIGH              8
+#define XHI_CMD_SWITCH              9
+#define XHI_CMD_GRESTORE            10
+#define XHI_CMD_SHUTDOWN            11
+#define XHI_CMD_GCAPTURE            12
+#define XHI_CMD_DESYNCH             13
+
+/* Packet constants */
+#define XHI_SYNC_PACKET             0xAA995566UL
+#define XHI_DUMMY_PACKET            0xFFFFFFFFUL
+#define XHI_NOOP_PACKET             (XHI_TYPE_1 << XHI_TYPE_SHIFT)
+#define XHI_TYPE_2_READ ((XHI_TYPE_2 << XHI_TYPE_SHIFT) | \
+            (XHI_OP_READ << XHI_OP_SHIFT))
+
+#define XHI_TYPE_2_WRITE ((XHI_TYPE_2 << XHI_TYPE_SHIFT) | \
+            (XHI_OP_WRITE << XHI_OP_SHIFT))
+
+#define XHI_TYPE2_CNT_MASK          0x07FFFFFF
+
+#define XHI_TYPE_1_PACKET_MAX_WORDS 2047UL
+#define XHI_TYPE_1_HEADER_BYTES     4
+#define XHI_TYPE_2_HEADER_BYTES     8
+
+/* Constant to use for CRC check when CRC has been disabled */
+#define XHI_DISABLED_AUTO_CRC       0x0000DEFCUL
+
+/* Error bits of the STAT register, see UG570 */
+#define XHI_STAT_CRC_ERROR_MASK     0x00000001  /* CRC of the bitstream did not match */
+#define XHI_STAT_ID_ERROR_MASK      0x00008000  /* IDCODE of the bitstream did not match */
+#define XHI_STAT_DEC_ERROR_MASK     0x00010000  /* decryption of the bitstream failed */
+
+/**
+ * hwicap_type_1_read - Generates a Type 1 read packet header.
+ * @reg: is the address of the register to be read back.
+ *
+ * Return:
+ * Generates a Type 1 read packet header, which is used to indirectly
+ * read registers in the configuration logic.  This packet must then
+ * be sent through the icap device, and a return packet received with
+ * the information.
+ */
+static inline u32 hwicap_type_1_read(u32 reg)
+{
+    return (XHI_TYPE_1 << XHI_TYPE_SHIFT) |
+        (reg << XHI_REGISTER_SHIFT) |
+        (XHI_OP_READ << XHI_OP_SHIFT);
+}
+
+/**
+ * hwicap_type_1_write - Generates a Type 1 write packet header
+ * @reg: is the address of the register to be read back.
+ *
+ * Return: Type 1 write packet header
+ */
+static inline u32 hwicap_type_1_write(u32 reg)
+{
+    return (XHI_TYPE_1 << XHI_TYPE_SHIFT) |
+        (reg << XHI_REGISTER_SHIFT) |
+        (XHI_OP_WRITE << XHI_OP_SHIFT);
+}
+
+/**
+ * icap_stat_error - Describe the error reported by the STAT register.
+ * @stat: value of the STAT register after a load.
+ *
+ * Return:
+ * A description of the first error bit that is set, or NULL if the
+ * ICAP accepted the bitstream.
+ */
+static inline const char *icap_stat_error(u32 stat)
+{
+    if (stat & XHI_STAT_CRC_ERROR_MASK)
+        return "CRC error";
+    if (stat & XHI_STAT_ID_ERROR_MASK)
+        return "IDCODE mismatch";
+    if (stat & XHI_STAT_DEC_ERROR_MASK)
+        return "decryption error";
+
+    return NULL;
+}
+
+#endif
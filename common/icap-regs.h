@@ -0,0 +1,286 @@
+/**
+* Register access layer for the AXI Lite control registers of the ICAP controllers and the AXI CDMA
+*
+* In multi-board setups the control registers are behind the chip-to-chip link and every read
+* stalls the CPU for a full round trip. The driver owns most of the control state, so registers
+* that only change when the driver writes them are kept in a shadow copy. Read-modify-write
+* sequences then use the shadow instead of the register, and writes that would not change a
+* shadowed register are skipped.
+*
+* Writes are ordered against earlier writes to the DDR by default. Register writes to the same
+* device are ordered anyway, so a sequence of writes only needs this barrier once: the earlier
+* writes of a sequence can use icap_reg_write_relaxed and the last one icap_reg_write.
+*
+* The number of register reads and writes is counted, so the link traffic of a load can be
+* checked. The counters are not protected against the interrupt handlers and are only meant as
+* statistics.
+*
+* The register functions are used from process context and from the interrupt handlers of the
+* drivers (hard and threaded), on the same register block. The valid flags of the shadows are
+* changed with atomic bit operations, so an update from one context does not drop the flag of a
+* register that the other context changed at the same time. A single shadowed register must still
+* only be used by one context at a time: the drivers only enable an interrupt while the process
+* context waits for it, and the interrupt registers are then only touched by the handler.
+* icap_regs_init, icap_regs_cache and icap_reg_poll are only called from process context.
+*
+* Waits for a register are limited by a time budget instead of a number of reads, because the
+* duration of a read depends on the link. The budget is derived from the time the ICAP needs for
+* the data. A wait spins for a short time and then sleeps with an increasing interval, so long
+* loads do not keep a CPU busy.
+**/
+#ifndef ICAP_REGS_H_    /* prevent circular inclusions */
+#define ICAP_REGS_H_    /* by using protection macros */
+
+#include <linux/types.h>
+#include <linux/bitmap.h>
+#include <linux/io.h>
+#include <linux/ktime.h>
+#include <linux/delay.h>
+#include <linux/math64.h>
+
+// Number of 32 bit registers that can be shadowed (covers the AXI HWICAP/HBICAP register map)
+#define ICAP_REGS_MAX 72
+
+// ICAP defaults if the device tree does not describe the ICAP
+#define ICAP_DEFAULT_CLOCK_HZ   100000000
+#define ICAP_DEFAULT_WIDTH      32
+
+// Time budget of a wait: ICAP_WAIT_FACTOR times the ICAP time of the data plus ICAP_WAIT_SLACK_NS.
+// The factor covers links that are slower than the ICAP, the slack covers the link latency and
+// the scheduling of the waiting thread.
+#define ICAP_WAIT_FACTOR        4
+#define ICAP_WAIT_SLACK_NS      (20 * NSEC_PER_MSEC)
+
+// A wait spins for ICAP_POLL_SPIN_NS, then sleeps between ICAP_POLL_SLEEP_MIN_US and ICAP_POLL_SLEEP_MAX_US
+#define ICAP_POLL_SPIN_NS       (10 * NSEC_PER_USEC)
+#define ICAP_POLL_SLEEP_MIN_US  10
+#define ICAP_POLL_SLEEP_MAX_US  1000
+
+struct icap_regs {
+    void __iomem *base;                     /* virt. address of the registers */
+    u32 shadow[ICAP_REGS_MAX];              /* last value written to or read from the register */
+    u32 self_clear[ICAP_REGS_MAX];          /* bits that the hardware clears after a write */
+    DECLARE_BITMAP(cached, ICAP_REGS_MAX);  /* the register is owned by the driver and shadowed */
+    DECLARE_BITMAP(valid, ICAP_REGS_MAX);   /* the shadow holds the register value */
+    u32 reads;                              /* register reads since the last icap_regs_reset_stats */
+    u32 writes;                             /* register writes since the last icap_regs_reset_stats */
+};
+
+/**
+ * icap_regs_init - Initialize the register access for a register block
+ * @regs: the register block
+ * @base: virt. address of the registers
+ *
+ * No register is shadowed until it is added with icap_regs_cache.
+ **/
+static inline void icap_regs_init(struct icap_regs *regs, void __iomem *base)
+{
+    memset(regs, 0, sizeof(*regs));
+    regs->base = base;
+}
+
+/**
+ * icap_regs_cache - Keep a shadow copy of a register
+ * @regs:       the register block
+ * @offset:     offset of the register
+ * @self_clear: bits that are cleared by the hardware after they were written (e.g. start bits)
+ *
+ * The register must only change when the driver writes it. The shadow is filled by the first
+ * read or write of the register.
+ **/
+static inline void icap_regs_cache(struct icap_regs *regs, u32 offset, u32 self_clear)
+{
+    set_bit(offset >> 2, regs->cached);
+    regs->self_clear[offset >> 2] = self_clear;
+}
+
+/**
+ * icap_regs_invalidate - Drop the shadow copies of all registers
+ * @regs: the register block
+ *
+ * Needed after the hardware changed the registers on its own, e.g. after a reset.
+ * The flags are cleared one by one, so a concurrent icap_regs_set_shadow is not lost.
+ **/
+static inline void icap_regs_invalidate(struct icap_regs *regs)
+{
+    unsigned int index;
+
+    for_each_set_bit(index, regs->valid, ICAP_REGS_MAX)
+        clear_bit(index, regs->valid);
+}
+
+/**
+ * icap_regs_reset_stats - Reset the read and write counters
+ * @regs: the register block
+ **/
+static inline void icap_regs_reset_stats(struct icap_regs *regs)
+{
+    regs->reads  = 0;
+    regs->writes = 0;
+}
+
+/**
+ * icap_regs_set_shadow - Set the shadow of a register without writing it
+ * @regs:   the register block
+ * @offset: offset of the register
+ * @value:  the value the register has in the hardware
+ *
+ * Used for values that are known without reading the register, e.g. after a reset.
+ * Nothing is done for registers that are not shadowed.
+ **/
+static inline void icap_regs_set_shadow(struct icap_regs *regs, u32 offset, u32 value)
+{
+    u32 index = offset >> 2;
+
+    if (!test_bit(index, regs->cached))
+        return;
+
+    regs->shadow[index] = value & ~regs->self_clear[index];
+    set_bit(index, regs->valid);
+}
+
+/**
+ * icap_reg_read - Read a register
+ * @regs:   the register block
+ * @offset: offset of the register
+ *
+ * A shadowed register is only read from the hardware if the shadow is not valid.
+ **/
+static inline u32 icap_reg_read(struct icap_regs *regs, u32 offset)
+{
+    u32 value;
+
+    if (test_bit(offset >> 2, regs->valid))
+        return regs->shadow[offset >> 2];
+
+    value = readl(regs->base + offset);
+    regs->reads++;
+    icap_regs_set_shadow(regs, offset, value);
+
+    return value;
+}
+
+/**
+ * icap_reg_write - Write a register after all earlier writes to the DDR
+ * @regs:   the register block
+ * @offset: offset of the register
+ * @value:  the value to write
+ **/
+static inline void icap_reg_write(struct icap_regs *regs, u32 offset, u32 value)
+{
+    writel(value, regs->base + offset);
+    regs->writes++;
+    icap_regs_set_shadow(regs, offset, value);
+}
+
+/**
+ * icap_reg_write_relaxed - Write a register without a barrier
+ * @regs:   the register block
+ * @offset: offset of the register
+ * @value:  the value to write
+ *
+ * The write is only ordered against other register writes of the device.
+ **/
+static inline void icap_reg_write_relaxed(struct icap_regs *regs, u32 offset, u32 value)
+{
+    writel_relaxed(value, regs->base + offset);
+    regs->writes++;
+    icap_regs_set_shadow(regs, offset, value);
+}
+
+/**
+ * icap_reg_update - Write a register if the value differs from the shadow
+ * @regs:   the register block
+ * @offset: offset of the register
+ * @value:  the value to write
+ *
+ * The write is relaxed. Registers without a valid shadow are always written.
+ **/
+static inline void icap_reg_update(struct icap_regs *regs, u32 offset, u32 value)
+{
+    if (test_bit(offset >> 2, regs->valid) && regs->shadow[offset >> 2] == value)
+        return;
+
+    icap_reg_write_relaxed(regs, offset, value);
+}
+
+/**
+ * icap_reg_update_bits - Read-modify-write of a register
+ * @regs:   the register block
+ * @offset: offset of the register
+ * @mask:   the bits to change
+ * @value:  the new value of the bits
+ *
+ * For a shadowed register, neither the read nor an unchanged write reach the hardware.
+ **/
+static inline void icap_reg_update_bits(struct icap_regs *regs, u32 offset, u32 mask, u32 value)
+{
+    u32 reg_data = icap_reg_read(regs, offset);
+
+    icap_reg_update(regs, offset, (reg_data & ~mask) | (value & mask));
+}
+
+/**
+ * icap_wait_budget_ns - Time budget for the ICAP to process data
+ * @bytes:    number of bytes that are processed by the ICAP
+ * @clock_hz: clock of the ICAP
+ * @width:    width of the ICAP in bits
+ **/
+static inline u64 icap_wait_budget_ns(u64 bytes, u32 clock_hz, u32 width)
+{
+    u64 icap_ns = div64_u64(bytes * 8 * NSEC_PER_SEC, (u64) clock_hz * width);
+
+    return ICAP_WAIT_FACTOR * icap_ns + ICAP_WAIT_SLACK_NS;
+}
+
+/**
+ * icap_reg_poll - Wait until one of the bits of a register is set
+ * @regs:     the register block
+ * @offset:   offset of the register
+ * @mask:     the bits to wait for
+ * @deadline: end of the wait
+ * @value:    returns the last value of the register, may be NULL
+ *
+ * Returns 0 if one of the bits is set or -ETIMEDOUT when the deadline passed. The
+ * register is read once more after the deadline, so a sleep that overran the deadline
+ * does not cause a timeout. Must be called from a context that can sleep.
+ **/
+static inline int icap_reg_poll(struct icap_regs *regs, u32 offset, u32 mask,
+                                ktime_t deadline, u32 *value)
+{
+    ktime_t spin_end = ktime_add_ns(ktime_get(), ICAP_POLL_SPIN_NS);
+    unsigned long sleep_us = ICAP_POLL_SLEEP_MIN_US;
+    bool expired = false;
+    u32 reg_data;
+    ktime_t now;
+    int status = 0;
+
+    for (;;) {
+        reg_data = icap_reg_read(regs, offset);
+        if (reg_data & mask)
+            break;
+        if (expired) {
+            status = -ETIMEDOUT;
+            break;
+        }
+
+        now = ktime_get();
+        if (ktime_after(now, deadline)) {
+            expired = true;
+        }
+        else if (ktime_before(now, spin_end)) {
+            cpu_relax();
+        }
+        else {
+            usleep_range(sleep_us, 2 * sleep_us);
+            sleep_us = min_t(unsigned long, 2 * sleep_us, ICAP_POLL_SLEEP_MAX_US);
+        }
+    }
+
+    if (value)
+        *value = reg_data;
+
+    return status;
+}
+
+#endif
@@ -0,0 +1,185 @@
+/**
+* Streaming decompression of zstd compressed bitstreams
+*
+* Partial bitstreams are mostly made of empty frames and NOOPs and compress well. Besides raw
+* bitstreams, the managers accept a bitstream in a single zstd frame. It is detected by the magic
+* number in the first bytes that write_init gets. The bitstream is decompressed in parts of the
+* staging buffers that are written to the ICAP controller, so the decompressed bitstream never
+* exists in memory as a whole, and the compressed one may be passed in parts of any size.
+*
+* The frame must record the decompressed size, which the zstd tool does for files. The decoder
+* keeps a window of the last decompressed bytes, so its workspace grows with the window size of
+* the frame: a small window (e.g. zstd -19 --zstd=wlog=17) keeps the workspace small. Frames with
+* a window larger than ICAP_UNZSTD_MAX_WINDOW are rejected.
+*
+* The zstd decoder of the kernel (CONFIG_ZSTD_DECOMPRESS) is used. Without it, compressed
+* bitstreams are rejected.
+**/
+#ifndef ICAP_UNZSTD_H_    /* prevent circular inclusions */
+#define ICAP_UNZSTD_H_    /* by using protection macros */
+
+#include <linux/types.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <asm/unaligned.h>
+#if IS_ENABLED(CONFIG_ZSTD_DECOMPRESS)
+#include <linux/zstd.h>
+#endif
+
+// Largest window of a compressed bitstream, the workspace of the decoder is a bit larger
+#define ICAP_UNZSTD_MAX_WINDOW  (8 << 20)
+
+// Magic number at the start of a zstd frame (little endian)
+#define ICAP_ZSTD_MAGIC         0xFD2FB528
+
+struct icap_unzstd {
+#if IS_ENABLED(CONFIG_ZSTD_DECOMPRESS)
+    ZSTD_DStream *stream;   /* the decoder, NULL if the bitstream is not compressed */
+#else
+    void *stream;           /* always NULL */
+#endif
+    void *workspace;        /* workspace of the decoder */
+    u64 size;               /* decompressed size of the frame */
+    u64 left;               /* decompressed bytes that were not read yet */
+    bool done;              /* the end of the frame was decoded */
+};
+
+/**
+ * icap_unzstd_detect - Check whether a bitstream is compressed
+ * @buf:  the first bytes of the bitstream
+ * @size: size of buf
+ **/
+static inline bool icap_unzstd_detect(const u8 *buf, size_t size)
+{
+    return size >= 4 && get_unaligned_le32(buf) == ICAP_ZSTD_MAGIC;
+}
+
+/**
+ * icap_unzstd_free - Free the decoder
+ * @z: the decoder
+ *
+ * Nothing is done if the decoder was not initialized.
+ **/
+static inline void icap_unzstd_free(struct icap_unzstd *z)
+{
+    kvfree(z->workspace);
+    z->workspace = NULL;
+    z->stream    = NULL;
+}
+
+#if IS_ENABLED(CONFIG_ZSTD_DECOMPRESS)
+/**
+ * icap_unzstd_init - Set up the decoder for a compressed bitstream
+ * @z:    the decoder, freed with icap_unzstd_free
+ * @buf:  the first bytes of the bitstream, at least the frame header
+ * @size: size of buf
+ *
+ * Returns 0, -EINVAL for a frame header that is not complete or without decompressed size,
+ * -E2BIG for a window larger than ICAP_UNZSTD_MAX_WINDOW or -ENOMEM.
+ **/
+static inline int icap_unzstd_init(struct icap_unzstd *z, const u8 *buf, size_t size)
+{
+    ZSTD_frameParams params;
+    size_t bound;
+
+    if (ZSTD_getFrameParams(&params, buf, size) || !params.frameContentSize)
+        return -EINVAL;
+    if (params.windowSize > ICAP_UNZSTD_MAX_WINDOW)
+        return -E2BIG;
+
+    bound = ZSTD_DStreamWorkspaceBound(params.windowSize);
+    z->workspace = kvmalloc(bound, GFP_KERNEL);
+    if (!z->workspace)
+        return -ENOMEM;
+
+    z->stream = ZSTD_initDStream(params.windowSize, z->workspace, bound);
+    if (!z->stream) {
+        icap_unzstd_free(z);
+        return -EINVAL;
+    }
+
+    z->size = params.frameContentSize;
+    z->left = z->size;
+    z->done = false;
+
+    return 0;
+}
+
+/**
+ * icap_unzstd_read - Decompress the next bytes of the bitstream
+ * @z:      the decoder
+ * @in:     next compressed bytes, advanced past the bytes that were used
+ * @in_len: number of compressed bytes, reduced by the bytes that were used
+ * @dst:    destination of the decompressed bytes
+ * @len:    number of bytes to decompress
+ *
+ * Returns the number of decompressed bytes, or -EINVAL if the compressed data is corrupt.
+ * Less than len bytes are returned only if all of in was used or the frame ended, the
+ * decoder keeps what it could not return yet.
+ **/
+static inline ssize_t icap_unzstd_read(struct icap_unzstd *z, const u8 **in, size_t *in_len,
+                                       void *dst, size_t len)
+{
+    ZSTD_inBuffer input = { *in, *in_len, 0 };
+    ZSTD_outBuffer output = { dst, min_t(u64, len, z->left), 0 };
+    size_t ret;
+
+    while (output.pos < output.size && !z->done) {
+        ret = ZSTD_decompressStream(z->stream, &output, &input);
+        if (ZSTD_isError(ret))
+            return -EINVAL;
+        if (!ret)
+            z->done = true;
+        else if (input.pos == input.size && output.pos < output.size)
+            break;
+    }
+
+    *in     += input.pos;
+    *in_len -= input.pos;
+    z->left -= output.pos;
+
+    return output.pos;
+}
+
+/**
+ * icap_unzstd_peek - Decompress the first bytes of the bitstream
+ * @z:    the decoder
+ * @buf:  the first bytes of the compressed bitstream
+ * @size: size of buf
+ * @dst:  destination of the decompressed bytes
+ * @len:  number of bytes to decompress
+ *
+ * The decoder is reset afterwards, so the bitstream is decompressed from its start again.
+ * Returns the number of decompressed bytes or -EINVAL.
+ **/
+static inline ssize_t icap_unzstd_peek(struct icap_unzstd *z, const u8 *buf, size_t size,
+                                       void *dst, size_t len)
+{
+    ssize_t ret = icap_unzstd_read(z, &buf, &size, dst, len);
+
+    ZSTD_resetDStream(z->stream);
+    z->left = z->size;
+    z->done = false;
+
+    return ret;
+}
+#else
+static inline int icap_unzstd_init(struct icap_unzstd *z, const u8 *buf, size_t size)
+{
+    return -EOPNOTSUPP;
+}
+
+static inline ssize_t icap_unzstd_read(struct icap_unzstd *z, const u8 **in, size_t *in_len,
+                                       void *dst, size_t len)
+{
+    return -EOPNOTSUPP;
+}
+
+static inline ssize_t icap_unzstd_peek(struct icap_unzstd *z, const u8 *buf, size_t size,
+                                       void *dst, size_t len)
+{
+    return -EOPNOTSUPP;
+}
+#endif
+
+#endif
@@ -5,6 +5,10 @@
 // AXI Lite register offsets
 #define XAXICDMA_CR_OFFSET             0x00000000  /* < Control register */
 #define XAXICDMA_SR_OFFSET             0x00000004  /* < Status register */
+#define XAXICDMA_CDESC_LOWER_OFFSET    0x00000008  /* < Lower current descriptor pointer (SG mode) */
+#define XAXICDMA_CDESC_HIGHER_OFFSET   0x0000000C  /* < Higher current descriptor pointer (SG mode) */
+#define XAXICDMA_TDESC_LOWER_OFFSET    0x00000010  /* < Lower tail descriptor pointer (SG mode) */
+#define XAXICDMA_TDESC_HIGHER_OFFSET   0x00000014  /* < Higher tail descriptor pointer (SG mode) */
 #define XAXICDMA_SRCADDR_LOWER_OFFSET  0x00000018  /* < Lowe source address register */
 #define XAXICDMA_SRCADDR_HIGHER_OFFSET 0x0000001C  /* < Higher source address register */
 #define XAXICDMA_DSTADDR_LOWER_OFFSET  0x00000020  /* < Lower destination address register */
@@ -13,21 +17,31 @@
 
 // Control register masks
 #define XAXICDMA_KEY_HOLE_WRITE        0x00000020 /* < Set key hole write */
+#define XAXICDMA_KEY_HOLE_READ         0x00000010 /* < Set key hole read */
 #define XAXICDMA_SIMPLE_IRQ            0x00005000 /* < Set ERR_IrqEn and IOC_IrqEn */
 #define XAXICDMA_RESET                 0x00000004 /* < Reset every register */
+#define XAXICDMA_SG_MODE               0x00000008 /* < Use the scatter gather engine */
+#define XAXICDMA_IRQ_THRESHOLD_ONE     0x00010000 /* < IRQThreshold = 1 (reset value) */
+#define XAXICDMA_IRQ_THRESHOLD_SHIFT   16         /* < IRQThreshold field */
+#define XAXICDMA_IRQ_THRESHOLD_MAX     255        /* < Largest IRQThreshold */
 
 // Status register masks
 #define XAXICDMA_IDLE                  0x00000002 /* < Check Idle bit */
 #define XACDMA_IOC_IRQ                 0x00001000 /* < Check IOC_Irq bit */
 #define XAXICDMA_ERR_IRQ               0x00004000 /* < Check Err_Irq bit */
+#define XAXICDMA_SG_INCLUDED           0x00000008 /* < Check SGIncld bit */
+#define XAXICDMA_IRQ_ALL               0x00007000 /* < IOC_Irq, Dly_Irq and Err_Irq */
 
-// Error flags
-#define XACDMA_NOT_IDLE               -1
-#define XACDMA_WRITE_ERROR            -2
-#define XACDMA_WRITE_TIMEOUT          -3
+// Descriptor status masks
+#define XAXICDMA_DESC_CMPLT            0x80000000 /* < Descriptor completed */
+#define XAXICDMA_DESC_ERR              0x70000000 /* < DMADecErr, DMASlvErr and DMAIntErr */
+#define XAXICDMA_DESC_BTT_MASK         0x03FFFFFF /* < Bytes to transfer field of the control word */
+
+// Error flags, they reach the FPGA framework and user space as they are
+#define XACDMA_NOT_IDLE               -EBUSY
+#define XACDMA_WRITE_ERROR            -EIO
+#define XACDMA_WRITE_TIMEOUT          -ETIMEDOUT
 
-// Additional defines
-#define XACDMA_MAX_RETRIES            10000
 
 /**
  * axi_cdma_set_interrupts - Enable the simple dma interrupts on error and complete
@@ -35,41 +49,61 @@
  **/
 static inline void axi_cdma_set_interrupts(struct hbicap_drvdata *drvdata)
 {
-    u32 control_register;
-    control_register = ioread32le(drvdata->cdma_virt_base_addr + XAXICDMA_CR_OFFSET);
-    iowrite32le(control_register | XAXICDMA_SIMPLE_IRQ, drvdata->cdma_virt_base_addr + XAXICDMA_CR_OFFSET);
+    icap_reg_update_bits(&drvdata->cdma_regs, XAXICDMA_CR_OFFSET, XAXICDMA_SIMPLE_IRQ, XAXICDMA_SIMPLE_IRQ);
+}
+
+/**
+ * axi_cdma_set_key_hole - Set or clear the key hole read and write modes
+ * @drvdata:  a pointer to the drvdata.
+ * @key_hole: XAXICDMA_KEY_HOLE_WRITE, XAXICDMA_KEY_HOLE_READ or 0
+ *
+ * With key hole writes, the CDMA writes all data to the destination address instead of
+ * incrementing it, with key hole reads it reads all data from the source address.
+ * The mode may only be changed while the CDMA is idle.
+ **/
+static inline void axi_cdma_set_key_hole(struct hbicap_drvdata *drvdata, u32 key_hole)
+{
+    icap_reg_update_bits(&drvdata->cdma_regs, XAXICDMA_CR_OFFSET,
+                         XAXICDMA_KEY_HOLE_WRITE | XAXICDMA_KEY_HOLE_READ, key_hole);
 }
 
 /**
  * axi_cdma_set_source_addr - Set the source address in the DDR for the data
  * @drvdata: a pointer to the drvdata.
  * @addr:    DDR source address 
+ *
+ * Only the parts of the address that changed since the last transfer are written.
  **/
 static inline void axi_cdma_set_source_addr(struct hbicap_drvdata *drvdata, u32 addr_higher, u32 addr_lower)
 {
-    iowrite32le(addr_higher, drvdata->cdma_virt_base_addr + XAXICDMA_SRCADDR_HIGHER_OFFSET);
-    iowrite32le(addr_lower , drvdata->cdma_virt_base_addr + XAXICDMA_SRCADDR_LOWER_OFFSET);
+    icap_reg_update(&drvdata->cdma_regs, XAXICDMA_SRCADDR_HIGHER_OFFSET, addr_higher);
+    icap_reg_update(&drvdata->cdma_regs, XAXICDMA_SRCADDR_LOWER_OFFSET, addr_lower);
 }
 
 /**
  * axi_cdma_set_destination_addr - Set the destination address aka AXI HBICAP data port
  * @drvdata: a pointer to the drvdata.
  * @addr:    destination address 
+ *
+ * Only the parts of the address that changed since the last transfer are written.
  **/
 static inline void axi_cdma_set_destination_addr(struct hbicap_drvdata *drvdata, u32 addr_higher, u32 addr_lower)
 {
-    iowrite32le(addr_higher, drvdata->cdma_virt_base_addr + XAXICDMA_DSTADDR_HIGHER_OFFSET);
-    iowrite32le(addr_lower , drvdata->cdma_virt_base_addr + XAXICDMA_DSTADDR_LOWER_OFFSET);
+    icap_reg_update(&drvdata->cdma_regs, XAXICDMA_DSTADDR_HIGHER_OFFSET, addr_higher);
+    icap_reg_update(&drvdata->cdma_regs, XAXICDMA_DSTADDR_LOWER_OFFSET, addr_lower);
 }
 
 /**
  * axi_cdma_set_length - Set the number of bytes and start the transmission
  * @drvdata: a pointer to the drvdata.
  * @length:  number of bytes to transmit
+ *
+ * The earlier register writes for the transfer are relaxed. The barrier of this
+ * write orders all of them and the data in the DDR before the start of the transfer.
  **/
 static inline void axi_cdma_set_size(struct hbicap_drvdata *drvdata, u32 size)
 {
-    iowrite32le(size, drvdata->cdma_virt_base_addr + XAXICDMA_BTT_OFFSET);
+    icap_reg_write(&drvdata->cdma_regs, XAXICDMA_BTT_OFFSET, size);
 }
 
 /**
@@ -79,36 +113,67 @@ static inline void axi_cdma_set_size(struct hbicap_drvdata *drvdata, u32 size)
 static inline u32 axi_cdma_check_IDLE(struct hbicap_drvdata *drvdata)
 {
     u32 status_register;
-    status_register = ioread32le(drvdata->cdma_virt_base_addr + XAXICDMA_SR_OFFSET);
+    status_register = icap_reg_read(&drvdata->cdma_regs, XAXICDMA_SR_OFFSET);
 
     return ((status_register & XAXICDMA_IDLE) ? 1 : 0);
 }
 
+/**
+ * axi_cdma_set_deadline - Start the time budget of a transfer
+ * @drvdata: a pointer to the drvdata.
+ * @size:    number of bytes of the transfer
+ *
+ * The HBICAP only accepts data as fast as the ICAP processes it, so the budget
+ * is derived from the ICAP clock and width.
+ **/
+static inline void axi_cdma_set_deadline(struct hbicap_drvdata *drvdata, u64 size)
+{
+    drvdata->cdma_deadline = ktime_add_ns(ktime_get(),
+            icap_wait_budget_ns(size, drvdata->icap_clock_hz, drvdata->icap_width));
+}
+
+/**
+ * axi_cdma_jiffies_left - Remaining time budget of the running transfer
+ * @drvdata: a pointer to the drvdata.
+ **/
+static inline unsigned long axi_cdma_jiffies_left(struct hbicap_drvdata *drvdata)
+{
+    s64 left = ktime_to_ns(ktime_sub(drvdata->cdma_deadline, ktime_get()));
+
+    // One more jiffy, so a completion that arrived in time is not missed
+    return nsecs_to_jiffies(max_t(s64, left, 0)) + 1;
+}
+
 /**
  * axi_cdma_busy - Wait until the transmission is finished, check for transmission errors
  * @drvdata: a pointer to the drvdata.
  **/
-static inline u32 axi_cdma_busy(struct hbicap_drvdata *drvdata)
+static inline int axi_cdma_busy(struct hbicap_drvdata *drvdata)
 {
     u32 status_register;
-    u32 retries = 0;
-    u32 status = 0;
+    int status = 0;
+
+    // The interrupt handler signals the completion and already reset the IOC_IRQ flag
+    if (drvdata->cdma_irq > 0) {
+        if (!wait_for_completion_timeout(&drvdata->cdma_done, axi_cdma_jiffies_left(drvdata)))
+            return XACDMA_WRITE_TIMEOUT;
+
+        if (drvdata->cdma_irq_status & XAXICDMA_ERR_IRQ)
+            status = XACDMA_WRITE_ERROR;
+
+        return status;
+    }
 
     // wait until the transmission is complete
-    do
+    if (icap_reg_poll(&drvdata->cdma_regs, XAXICDMA_SR_OFFSET, XACDMA_IOC_IRQ,
+                      drvdata->cdma_deadline, &status_register))
     {
-        status_register = ioread32le(drvdata->cdma_virt_base_addr + XAXICDMA_SR_OFFSET);
-        retries++;
-        if (retries > XACDMA_MAX_RETRIES)
-        {
-            status = XACDMA_WRITE_TIMEOUT;
-            goto error;
-        }
+        status = XACDMA_WRITE_TIMEOUT;
+        goto error;
     }
-    while(!(status_register & XACDMA_IOC_IRQ));
 
     // Reset IOC_IRQ flag
-    iowrite32le(XACDMA_IOC_IRQ, drvdata->cdma_virt_base_addr + XAXICDMA_SR_OFFSET);
+    icap_reg_write(&drvdata->cdma_regs, XAXICDMA_SR_OFFSET, XACDMA_IOC_IRQ);
 
    // Check the ERR_IRQ flag
     if(status_register & XAXICDMA_ERR_IRQ)
@@ -118,13 +183,99 @@ error:
     return status;
 }
 
+/**
+ * axi_cdma_regs_init - Set up the register access of the AXI CDMA
+ * @drvdata: a pointer to the drvdata.
+ *
+ * The control and address registers only change when they are written by the driver
+ * or on a reset, so they are shadowed. The status register is always read.
+ **/
+void axi_cdma_regs_init(struct hbicap_drvdata *drvdata)
+{
+    struct icap_regs *regs = &drvdata->cdma_regs;
+
+    icap_regs_init(regs, drvdata->cdma_virt_base_addr);
+    icap_regs_cache(regs, XAXICDMA_CR_OFFSET, XAXICDMA_RESET);
+    icap_regs_cache(regs, XAXICDMA_SRCADDR_LOWER_OFFSET, 0);
+    icap_regs_cache(regs, XAXICDMA_SRCADDR_HIGHER_OFFSET, 0);
+    icap_regs_cache(regs, XAXICDMA_DSTADDR_LOWER_OFFSET, 0);
+    icap_regs_cache(regs, XAXICDMA_DSTADDR_HIGHER_OFFSET, 0);
+}
+
 /**
  * axi_cdma_reset - Reset every register of the AXI CDMA
  * @drvdata: a pointer to the drvdata.
  **/
 void axi_cdma_reset(struct hbicap_drvdata *drvdata)
 {
-    iowrite32le(XAXICDMA_RESET, drvdata->cdma_virt_base_addr + XAXICDMA_CR_OFFSET);
+    icap_reg_write(&drvdata->cdma_regs, XAXICDMA_CR_OFFSET, XAXICDMA_RESET);
+
+    // All registers return to their reset values
+    icap_regs_invalidate(&drvdata->cdma_regs);
+}
+
+/**
+* axi_cdma_start - Program a transfer without waiting for it
+* @drvdata: a pointer to the drvdata.
+* @source_addr_higher: the higher 32 bits of the source address
+* @source_addr_lower: the lower 32 bits of the source address
+* @destination_addr_higher: the higher 32 bits of the destination address
+* @destination_addr_lower: the lower 32 bits of the destination address
+* @size: the size of the data (in bytes)
+* @key_hole: the key hole mode of the transfer
+**/
+static int axi_cdma_start(struct hbicap_drvdata *drvdata, u32 source_addr_higher, u32 source_addr_lower,
+                          u32 destination_addr_higher, u32 destination_addr_lower, u32 size, u32 key_hole)
+{
+    // Check if CDMA is idle
+    if(!axi_cdma_check_IDLE(drvdata))
+        return XACDMA_NOT_IDLE;
+
+    // Set CDMA interrupts and the key hole mode
+    axi_cdma_set_interrupts(drvdata);
+    axi_cdma_set_key_hole(drvdata, key_hole);
+    reinit_completion(&drvdata->cdma_done);
+
+    // Set CDMA source address
+    axi_cdma_set_source_addr(drvdata, source_addr_higher, source_addr_lower);
+
+    // Set the CDMA destination address
+    axi_cdma_set_destination_addr(drvdata, destination_addr_higher, destination_addr_lower);
+
+    // start the transfer
+    axi_cdma_set_deadline(drvdata, size);
+    axi_cdma_set_size(drvdata, size);
+
+    return 0;
+}
+
+/**
+* axi_cdma_start_write - Program a transfer from DDR to PL without waiting for it
+* @drvdata: a pointer to the drvdata.
+* @source_addr_lower: the lower 32 bits of the physical DDR base address
+* @source_addr_higher: the higher 32 bits of the physical DDR base address
+* @destination_addr_lower: the lower 32 bits of the AXI address in the PL
+* @destination_addr_higher: the higher 32 bits of the AXI address in the PL
+* @size: the size of the data to be written (in bytes)
+*
+* The transfer is running when this function returns. Use axi_cdma_wait_write
+* to wait for its completion.
+**/
+int axi_cdma_start_write(struct hbicap_drvdata *drvdata,  u32 source_addr_higher, u32 source_addr_lower,
+                    u32 destination_addr_higher, u32 destination_addr_lower, u32 size)
+{
+    return axi_cdma_start(drvdata, source_addr_higher, source_addr_lower,
+                          destination_addr_higher, destination_addr_lower, size,
+                          drvdata->cdma_key_hole_write ? XAXICDMA_KEY_HOLE_WRITE : 0);
+}
+
+/**
+* axi_cdma_wait_write - Wait for the transfer started with axi_cdma_start_write
+* @drvdata: a pointer to the drvdata.
+**/
+int axi_cdma_wait_write(struct hbicap_drvdata *drvdata)
+{
+    return axi_cdma_busy(drvdata);
 }
 
 /**
@@ -141,27 +292,249 @@ int axi_cdma_write(struct hbicap_drvdata *drvdata,  u32 source_addr_higher, u32
 {
     int status = 0;
 
-    // Check if CDMA is idle
-    if(!axi_cdma_check_IDLE(drvdata)){
-        status = XACDMA_NOT_IDLE;
+    status = axi_cdma_start_write(drvdata, source_addr_higher, source_addr_lower,
+                    destination_addr_higher, destination_addr_lower, size);
+    if (status)
         goto error;
-    }
 
-    // Set CDMA interrupts
-    axi_cdma_set_interrupts(drvdata);
+    // Check if the transmission was sucessfull
+    status = axi_cdma_busy(drvdata);
 
-    // Set CDMA source address
-    axi_cdma_set_source_addr(drvdata, source_addr_higher, source_addr_lower);
+error:
+    return status;
+}
 
-    // Set the CDMA destination address
-    axi_cdma_set_destination_addr(drvdata, destination_addr_higher, destination_addr_lower);
+/**
+* axi_cdma_read - Read data from PL to DDR
+* @drvdata: a pointer to the drvdata.
+* @source_addr_higher: the higher 32 bits of the AXI address in the PL
+* @source_addr_lower: the lower 32 bits of the AXI address in the PL
+* @destination_addr_higher: the higher 32 bits of the physical DDR base address
+* @destination_addr_lower: the lower 32 bits of the physical DDR base address
+* @size: the size of the data to be read (in bytes)
+*
+* If the CDMA uses key hole writes, it also reads with key hole reads from the PL.
+**/
+int axi_cdma_read(struct hbicap_drvdata *drvdata, u32 source_addr_higher, u32 source_addr_lower,
+                  u32 destination_addr_higher, u32 destination_addr_lower, u32 size)
+{
+    int status;
 
-    // write the data to the HBICAP
-    axi_cdma_set_size(drvdata, size);
+    status = axi_cdma_start(drvdata, source_addr_higher, source_addr_lower,
+                            destination_addr_higher, destination_addr_lower, size,
+                            drvdata->cdma_key_hole_write ? XAXICDMA_KEY_HOLE_READ : 0);
+    if (status)
+        return status;
 
     // Check if the transmission was sucessfull
-    status = axi_cdma_busy(drvdata);
+    return axi_cdma_busy(drvdata);
+}
+
+/**
+ * axi_cdma_sg_included - Check if the CDMA was built with the scatter gather engine
+ * @drvdata: a pointer to the drvdata.
+ **/
+bool axi_cdma_sg_included(struct hbicap_drvdata *drvdata)
+{
+    u32 status_register;
+    status_register = icap_reg_read(&drvdata->cdma_regs, XAXICDMA_SR_OFFSET);
+
+    return (status_register & XAXICDMA_SG_INCLUDED) ? true : false;
+}
+
+/**
+ * axi_cdma_sg_chain_alloc - Allocate a descriptor chain for the scatter gather engine
+ * @dev:   the device that owns the descriptor memory
+ * @chain: the chain to be initialized
+ * @count: the maximum number of descriptors in the chain
+ **/
+int axi_cdma_sg_chain_alloc(struct device *dev, struct axi_cdma_sg_chain *chain, u32 count)
+{
+    chain->descs = dma_alloc_coherent(dev, count * sizeof(*chain->descs),
+                                      &chain->descs_phys, GFP_KERNEL);
+    if (!chain->descs)
+        return -ENOMEM;
+
+    chain->dev   = dev;
+    chain->count = count;
+    chain->used  = 0;
+    chain->size  = 0;
+
+    return 0;
+}
+
+/**
+ * axi_cdma_sg_chain_free - Release the memory of a descriptor chain
+ * @chain: the chain to be released
+ **/
+void axi_cdma_sg_chain_free(struct axi_cdma_sg_chain *chain)
+{
+    dma_free_coherent(chain->dev, chain->count * sizeof(*chain->descs),
+                      chain->descs, chain->descs_phys);
+    chain->descs = NULL;
+}
+
+/**
+ * axi_cdma_sg_chain_add - Append a transfer to a descriptor chain
+ * @chain: the descriptor chain
+ * @source_addr: the physical DDR source address
+ * @destination_addr: the AXI destination address in the PL
+ * @size: the size of the data to be written (in bytes)
+ **/
+int axi_cdma_sg_chain_add(struct axi_cdma_sg_chain *chain, dma_addr_t source_addr,
+                          u64 destination_addr, u32 size)
+{
+    struct axi_cdma_sg_desc *desc;
+    dma_addr_t next;
+
+    if (chain->used >= chain->count || size == 0 || size > XAXICDMA_DESC_BTT_MASK)
+        return -EINVAL;
+
+    desc = &chain->descs[chain->used];
+    next = chain->descs_phys + (chain->used + 1) * sizeof(*desc);
+
+    memset(desc, 0, sizeof(*desc));
+    desc->next_lower   = lower_32_bits(next);
+    desc->next_higher  = upper_32_bits(next);
+    desc->src_lower    = lower_32_bits(source_addr);
+    desc->src_higher   = upper_32_bits(source_addr);
+    desc->dst_lower    = lower_32_bits(destination_addr);
+    desc->dst_higher   = upper_32_bits(destination_addr);
+    desc->control      = size;
+
+    chain->used++;
+    chain->size += size;
+
+    return 0;
+}
+
+/**
+ * axi_cdma_sg_run - Run a part of a descriptor chain and wait until it is processed
+ * @drvdata: a pointer to the drvdata.
+ * @chain:   the descriptor chain
+ * @first:   index of the first descriptor
+ * @count:   number of descriptors, at most XAXICDMA_IRQ_THRESHOLD_MAX
+ *
+ * The IRQThreshold is set to the number of descriptors, so the IOC interrupt is only
+ * raised once, when the last descriptor is done. The IDLE bit is confirmed afterwards.
+ **/
+static int axi_cdma_sg_run(struct hbicap_drvdata *drvdata, struct axi_cdma_sg_chain *chain,
+                           u32 first, u32 count)
+{
+    struct axi_cdma_sg_desc *tail = &chain->descs[first + count - 1];
+    dma_addr_t head_phys = chain->descs_phys + first * sizeof(*tail);
+    dma_addr_t tail_phys = chain->descs_phys + (first + count - 1) * sizeof(*tail);
+    u32 status_register;
+    u64 size = 0;
+    u32 i;
+
+    for (i = first; i < first + count; i++)
+        size += chain->descs[i].control & XAXICDMA_DESC_BTT_MASK;
+
+    // The mode can only be switched while the CDMA is idle
+    icap_reg_update(&drvdata->cdma_regs, XAXICDMA_CR_OFFSET,
+                    XAXICDMA_SG_MODE | XAXICDMA_SIMPLE_IRQ |
+                    (count << XAXICDMA_IRQ_THRESHOLD_SHIFT) |
+                    (drvdata->cdma_key_hole_write ? XAXICDMA_KEY_HOLE_WRITE : 0));
+    reinit_completion(&drvdata->cdma_done);
+
+    // Set the first descriptor. Writing the tail descriptor starts the chain, its
+    // barrier orders the descriptors in the DDR before the start.
+    icap_reg_write_relaxed(&drvdata->cdma_regs, XAXICDMA_CDESC_HIGHER_OFFSET, upper_32_bits(head_phys));
+    icap_reg_write_relaxed(&drvdata->cdma_regs, XAXICDMA_CDESC_LOWER_OFFSET, lower_32_bits(head_phys));
+    icap_reg_write_relaxed(&drvdata->cdma_regs, XAXICDMA_TDESC_HIGHER_OFFSET, upper_32_bits(tail_phys));
+    axi_cdma_set_deadline(drvdata, size);
+    icap_reg_write(&drvdata->cdma_regs, XAXICDMA_TDESC_LOWER_OFFSET, lower_32_bits(tail_phys));
+
+    // Wait until the chain is processed or an error stopped the engine
+    if (drvdata->cdma_irq > 0) {
+        if (!wait_for_completion_timeout(&drvdata->cdma_done, axi_cdma_jiffies_left(drvdata)))
+            return XACDMA_WRITE_TIMEOUT;
+        status_register = drvdata->cdma_irq_status;
+    }
+
+    // The IOC interrupt may come before the engine is idle
+    if (drvdata->cdma_irq <= 0 || !(status_register & XAXICDMA_ERR_IRQ)) {
+        if (icap_reg_poll(&drvdata->cdma_regs, XAXICDMA_SR_OFFSET, XAXICDMA_IDLE | XAXICDMA_ERR_IRQ,
+                          drvdata->cdma_deadline, &status_register))
+            return XACDMA_WRITE_TIMEOUT;
+    }
+
+    if ((status_register & XAXICDMA_ERR_IRQ) ||
+        (READ_ONCE(tail->status) & (XAXICDMA_DESC_CMPLT | XAXICDMA_DESC_ERR)) != XAXICDMA_DESC_CMPLT)
+        return XACDMA_WRITE_ERROR;
+
+    return 0;
+}
+
+/**
+ * axi_cdma_sg_write - Run a descriptor chain and wait until it is processed
+ * @drvdata: a pointer to the drvdata.
+ * @chain:   the descriptor chain
+ *
+ * The CDMA is switched into scatter gather mode and the chain is started with one
+ * write of the tail descriptor pointer, in parts of up to XAXICDMA_IRQ_THRESHOLD_MAX
+ * descriptors. Every part costs one interrupt and a few register accesses. The CDMA
+ * is switched back into simple mode afterwards.
+ **/
+int axi_cdma_sg_write(struct hbicap_drvdata *drvdata, struct axi_cdma_sg_chain *chain)
+{
+    u32 first;
+    u32 count;
+    int status = 0;
+
+    if (chain->used == 0)
+        return 0;
+
+    // Check if CDMA is idle
+    if(!axi_cdma_check_IDLE(drvdata))
+        return XACDMA_NOT_IDLE;
+
+    for (first = 0; first < chain->used && !status; first += count) {
+        count  = min_t(u32, chain->used - first, XAXICDMA_IRQ_THRESHOLD_MAX);
+        status = axi_cdma_sg_run(drvdata, chain, first, count);
+    }
+
+    // The shadows of the simple mode address registers are not kept in scatter gather mode
+    icap_regs_invalidate(&drvdata->cdma_regs);
+
+    // Go back to simple mode. A reset is needed to stop a chain that did not finish.
+    if (status)
+        axi_cdma_reset(drvdata);
+    else
+        icap_reg_write_relaxed(&drvdata->cdma_regs, XAXICDMA_CR_OFFSET, XAXICDMA_IRQ_THRESHOLD_ONE);
+
+    // Reset the interrupt flags
+    icap_reg_write_relaxed(&drvdata->cdma_regs, XAXICDMA_SR_OFFSET, XAXICDMA_IRQ_ALL);
 
-error:
     return status;
 }
+
+/**
+ * axi_cdma_irq_handler - Interrupt handler for the IOC and ERR interrupts of the CDMA
+ * @irq:    the interrupt number
+ * @dev_id: a pointer to the drvdata.
+ *
+ * The completion is signaled on the IOC or ERR interrupt. In scatter gather mode the
+ * IRQThreshold makes the IOC interrupt mark the end of the chain, the waiting thread
+ * then confirms that the CDMA is idle.
+ **/
+irqreturn_t axi_cdma_irq_handler(int irq, void *dev_id)
+{
+    struct hbicap_drvdata *drvdata = dev_id;
+    u32 status_register;
+
+    status_register = icap_reg_read(&drvdata->cdma_regs, XAXICDMA_SR_OFFSET);
+    if (!(status_register & XAXICDMA_IRQ_ALL))
+        return IRQ_NONE;
+
+    // Reset the interrupt flags
+    icap_reg_write_relaxed(&drvdata->cdma_regs, XAXICDMA_SR_OFFSET, status_register & XAXICDMA_IRQ_ALL);
+
+    if (status_register & (XACDMA_IOC_IRQ | XAXICDMA_ERR_IRQ)) {
+        drvdata->cdma_irq_status = status_register;
+        complete(&drvdata->cdma_done);
+    }
+
+    return IRQ_HANDLED;
+}
@@ -10,12 +10,59 @@
 #include <linux/types.h>
 #include <linux/cdev.h>
 #include <linux/platform_device.h>
+#include <linux/dma-mapping.h>
+#include <linux/interrupt.h>
 
 #include <asm/io.h>
 #include "hbicap-fpga.h"
 
-#define iowrite32le(v,p) ({ __iowmb(); __raw_writel((__force __u32) cpu_to_le32(v), p); })
-#define ioread32le(p)    ({ __u32 __v = le32_to_cpu((__force __le32)__raw_readl(p)); __iormb(__v); __v; })
+// Default width of the bytes to transfer register (PG034: 8 to 26 bits)
+#define XAXICDMA_DEFAULT_BTT_WIDTH 23
+
+/**
+ * axi_cdma_max_transfer_size - Largest multiple of 32 bit words that fits into the bytes to transfer register
+ * @btt_width: width of the bytes to transfer register in bits
+ **/
+static inline u32 axi_cdma_max_transfer_size(u32 btt_width)
+{
+    if (btt_width < 8 || btt_width > 26)
+        btt_width = XAXICDMA_DEFAULT_BTT_WIDTH;
+
+    return ((1U << btt_width) - 1) & ~3U;
+}
+
+/**
+ * struct axi_cdma_sg_desc - Scatter gather transfer descriptor (PG034, must be 64 byte aligned)
+ **/
+struct axi_cdma_sg_desc {
+    u32 next_lower;                 /* lower 32 bits of the next descriptor */
+    u32 next_higher;                /* higher 32 bits of the next descriptor */
+    u32 src_lower;                  /* lower 32 bits of the source address */
+    u32 src_higher;                 /* higher 32 bits of the source address */
+    u32 dst_lower;                  /* lower 32 bits of the destination address */
+    u32 dst_higher;                 /* higher 32 bits of the destination address */
+    u32 control;                    /* bytes to transfer */
+    u32 status;                     /* completion and error flags, written by the CDMA */
+    u32 reserved[8];
+} __aligned(64);
+
+/**
+ * struct axi_cdma_sg_chain - Chain of scatter gather descriptors in coherent memory
+ **/
+struct axi_cdma_sg_chain {
+    struct device *dev;             /* device that owns the descriptor memory */
+    struct axi_cdma_sg_desc *descs; /* virt. address of the descriptors */
+    dma_addr_t descs_phys;          /* phys. address of the descriptors */
+    u32 count;                      /* number of allocated descriptors */
+    u32 used;                       /* number of descriptors in the chain */
+    u64 size;                       /* number of bytes transferred by the chain */
+};
+
+/**
+ * axi_cdma_regs_init - Set up the register access of the AXI CDMA
+ * @drvdata: a pointer to the drvdata.
+ **/
+void axi_cdma_regs_init(struct hbicap_drvdata *drvdata);
 
 /**
  * axi_cdma_reset - Reset every register of the AXI CDMA
@@ -23,6 +70,24 @@
  **/
 void axi_cdma_reset(struct hbicap_drvdata *drvdata);
 
+/**
+* axi_cdma_start_write - Program a transfer from DDR to PL without waiting for it
+* @drvdata: a pointer to the drvdata.
+* @source_addr_lower: the lower 32 bits of the physical DDR base address
+* @source_addr_higher: the higher 32 bits of the physical DDR base address
+* @destination_addr_lower: the lower 32 bits of the AXI address in the PL
+* @destination_addr_higher: the higher 32 bits of the AXI address in the PL
+* @size: the size of the data to be written (in bytes)
+**/
+int axi_cdma_start_write(struct hbicap_drvdata *drvdata,  u32 source_addr_higher, u32 source_addr_lower,
+                    u32 destination_addr_higher, u32 destination_addr_lower, u32 size);
+
+/**
+* axi_cdma_wait_write - Wait for the transfer started with axi_cdma_start_write
+* @drvdata: a pointer to the drvdata.
+**/
+int axi_cdma_wait_write(struct hbicap_drvdata *drvdata);
+
 /**
 * axi_cdma_write - Write data from DDR to PL
 * @drvdata: a pointer to the drvdata.
@@ -35,4 +100,60 @@ void axi_cdma_reset(struct hbicap_drvdata *drvdata);
 int axi_cdma_write(struct hbicap_drvdata *drvdata,  u32 source_addr_higher, u32 source_addr_lower,
                     u32 destination_addr_higher, u32 destination_addr_lower, u32 size);
 
+/**
+* axi_cdma_read - Read data from PL to DDR
+* @drvdata: a pointer to the drvdata.
+* @source_addr_higher: the higher 32 bits of the AXI address in the PL
+* @source_addr_lower: the lower 32 bits of the AXI address in the PL
+* @destination_addr_higher: the higher 32 bits of the physical DDR base address
+* @destination_addr_lower: the lower 32 bits of the physical DDR base address
+* @size: the size of the data to be read (in bytes)
+**/
+int axi_cdma_read(struct hbicap_drvdata *drvdata, u32 source_addr_higher, u32 source_addr_lower,
+                  u32 destination_addr_higher, u32 destination_addr_lower, u32 size);
+
+/**
+ * axi_cdma_sg_included - Check if the CDMA was built with the scatter gather engine
+ * @drvdata: a pointer to the drvdata.
+ **/
+bool axi_cdma_sg_included(struct hbicap_drvdata *drvdata);
+
+/**
+ * axi_cdma_sg_chain_alloc - Allocate a descriptor chain for the scatter gather engine
+ * @dev:   the device that owns the descriptor memory
+ * @chain: the chain to be initialized
+ * @count: the maximum number of descriptors in the chain
+ **/
+int axi_cdma_sg_chain_alloc(struct device *dev, struct axi_cdma_sg_chain *chain, u32 count);
+
+/**
+ * axi_cdma_sg_chain_free - Release the memory of a descriptor chain
+ * @chain: the chain to be released
+ **/
+void axi_cdma_sg_chain_free(struct axi_cdma_sg_chain *chain);
+
+/**
+ * axi_cdma_sg_chain_add - Append a transfer to a descriptor chain
+ * @chain: the descriptor chain
+ * @source_addr: the physical DDR source address
+ * @destination_addr: the AXI destination address in the PL
+ * @size: the size of the data to be written (in bytes)
+ **/
+int axi_cdma_sg_chain_add(struct axi_cdma_sg_chain *chain, dma_addr_t source_addr,
+                          u64 destination_addr, u32 size);
+
+/**
+ * axi_cdma_sg_write - Run a descriptor chain and wait until it is processed
+ * @drvdata: a pointer to the drvdata.
+ * @chain:   the descriptor chain
+ **/
+int axi_cdma_sg_write(struct hbicap_drvdata *drvdata, struct axi_cdma_sg_chain *chain);
+
+/**
+ * axi_cdma_irq_handler - Interrupt handler for the IOC and ERR interrupts of the CDMA
+ * @irq:    the interrupt number
+ * @dev_id: a pointer to the drvdata.
+ **/
+irqreturn_t axi_cdma_irq_handler(int irq, void *dev_id);
+
 #endif
@@ -48,6 +48,23 @@
 #define XHI_SR_EOS_BIT_MASK    0x00000004 /* EOS Bit Mask */
 #define XHI_SR_DONE_MASK       0x00000001 /* Done bit Mask  */
 
+/**
+ * axi_hbicap_regs_init - Set up the register access of the AXI Lite control registers
+ * @drvdata: a pointer to the drvdata.
+ *
+ * The control and interrupt enable registers only change when they are written by
+ * the driver, so they are shadowed. The read command bit is cleared by the HBICAP.
+ **/
+void axi_hbicap_regs_init(struct hbicap_drvdata *drvdata)
+{
+    struct icap_regs *regs = &drvdata->lite_regs;
+
+    icap_regs_init(regs, drvdata->axi_lite_virt_base_addr);
+    icap_regs_cache(regs, XHI_CR_OFFSET, XHI_CR_READ_MASK | XHI_CR_ABORT_MASK);
+    icap_regs_cache(regs, XHI_GIER_OFFSET, 0);
+    icap_regs_cache(regs, XHI_IPIER_OFFSET, 0);
+}
+
 /**
  * axi_hbicap_set_size_register - Set the the size register (number
  * of 32 bit transmission words)
@@ -56,7 +73,7 @@
  **/
 void axi_hbicap_set_size_register(struct hbicap_drvdata *drvdata, u32 data)
 {
-    iowrite32le(data, drvdata->axi_lite_virt_base_addr + XHI_SZ_OFFSET);
+    icap_reg_write(&drvdata->lite_regs, XHI_SZ_OFFSET, data);
 }
 
 /**
@@ -65,10 +82,51 @@ void axi_hbicap_set_size_register(struct hbicap_drvdata *drvdata, u32 data)
  **/
 u32 axi_hbicap_busy(struct hbicap_drvdata *drvdata)
 {
-    u32 status = ioread32le(drvdata->axi_lite_virt_base_addr + XHI_SR_OFFSET);
+    u32 status = icap_reg_read(&drvdata->lite_regs, XHI_SR_OFFSET);
     return (status & XHI_SR_DONE_MASK) ? 0 : 1;
 }
 
+/**
+ * axi_hbicap_start_readback - Start a readback from the ICAP into the read FIFO
+ * @drvdata:   a pointer to the drvdata.
+ * @num_words: the number of 32 bit words to read
+ *
+ * The read data is taken from the read FIFO through the AXI data port.
+ **/
+void axi_hbicap_start_readback(struct hbicap_drvdata *drvdata, u32 num_words)
+{
+    u32 reg_data = icap_reg_read(&drvdata->lite_regs, XHI_CR_OFFSET);
+
+    icap_reg_write_relaxed(&drvdata->lite_regs, XHI_SZ_OFFSET, num_words);
+    icap_reg_write(&drvdata->lite_regs, XHI_CR_OFFSET, reg_data | XHI_CR_READ_MASK);
+}
+
+/**
+ * axi_hbicap_abort - Abort the current ICAP transaction and reset the HBICAP
+ * @drvdata: a pointer to the drvdata.
+ *
+ * Used to stop a readback before all words were read.
+ **/
+void axi_hbicap_abort(struct hbicap_drvdata *drvdata)
+{
+    u32 reg_data = icap_reg_read(&drvdata->lite_regs, XHI_CR_OFFSET);
+
+    icap_reg_write(&drvdata->lite_regs, XHI_CR_OFFSET, reg_data | XHI_CR_ABORT_MASK);
+    axi_hbicap_reset(drvdata);
+}
+
+/**
+ * axi_hbicap_wait_done - Wait until the ICAP processed the whole transaction.
+ * @drvdata:  a pointer to the drvdata.
+ * @deadline: end of the wait
+ *
+ * Returns 0 if the done bit is set or -ETIMEDOUT.
+ **/
+int axi_hbicap_wait_done(struct hbicap_drvdata *drvdata, ktime_t deadline)
+{
+    return icap_reg_poll(&drvdata->lite_regs, XHI_SR_OFFSET, XHI_SR_DONE_MASK, deadline, NULL);
+}
+
 /**
  * axi_hbicap_reset - Reset the logic of the HBICAP
  * @drvdata: a pointer to the drvdata.
@@ -82,15 +140,20 @@ void axi_hbicap_reset(struct hbicap_drvdata *drvdata)
     u32 reg_data;
     /*
      * Reset the device by setting/clearing the RESET bit in the
-     * Control Register.
+     * Control Register. The control register is shadowed, so only the
+     * first reset reads it.
      */
-    reg_data = ioread32le(drvdata->axi_lite_virt_base_addr + XHI_CR_OFFSET);
+    reg_data = icap_reg_read(&drvdata->lite_regs, XHI_CR_OFFSET);
 
-    iowrite32le(reg_data | XHI_CR_SW_RESET_MASK,
-                drvdata->axi_lite_virt_base_addr + XHI_CR_OFFSET);
+    icap_reg_write_relaxed(&drvdata->lite_regs, XHI_CR_OFFSET,
+                           reg_data | XHI_CR_SW_RESET_MASK);
 
-    iowrite32le(reg_data & (~XHI_CR_SW_RESET_MASK),
-                drvdata->axi_lite_virt_base_addr + XHI_CR_OFFSET);
+    icap_reg_write_relaxed(&drvdata->lite_regs, XHI_CR_OFFSET,
+                           reg_data & (~XHI_CR_SW_RESET_MASK));
+
+    // The interrupt enable registers returned to their reset values
+    icap_regs_set_shadow(&drvdata->lite_regs, XHI_GIER_OFFSET, 0);
+    icap_regs_set_shadow(&drvdata->lite_regs, XHI_IPIER_OFFSET, 0);
 }
 
 /**
@@ -102,5 +165,97 @@ void axi_hbicap_reset(struct hbicap_drvdata *drvdata)
 static inline u32 axi_hbicap_write_fifo_vacancy(
         struct hbicap_drvdata *drvdata)
 {
-    return ioread32le(drvdata->axi_lite_virt_base_addr + XHI_WFV_OFFSET);
+    return icap_reg_read(&drvdata->lite_regs, XHI_WFV_OFFSET);
+}
+
+/**
+ * axi_hbicap_pio_write - Write data from the CPU to the AXI data port
+ * @drvdata:   a pointer to the drvdata.
+ * @data:      the data to write
+ * @num_words: the number of 32 bit words to write
+ * @deadline:  end of the wait for space in the write FIFO
+ *
+ * The data port is mapped as device memory, so the words reach the write FIFO in the
+ * order they are written, also where the offset wraps to the start of the window.
+ * Only as many words as the write FIFO has space for are written before the vacancy
+ * is read again.
+ **/
+int axi_hbicap_pio_write(struct hbicap_drvdata *drvdata, const u32 *data,
+                         u32 num_words, ktime_t deadline)
+{
+    u32 window_words = drvdata->axi_data_size >> 2;
+    u32 offset = 0;
+    u32 vacancy;
+    u32 count;
+
+    while (num_words > 0) {
+        if (icap_reg_poll(&drvdata->lite_regs, XHI_WFV_OFFSET, ~0U, deadline, &vacancy))
+            return -ETIMEDOUT;
+
+        count = min3(vacancy, num_words, window_words - offset);
+        __iowrite32_copy(drvdata->axi_data_virt_base_addr + (offset << 2), data, count);
+
+        // Complete the writes before the vacancy is read again
+        wmb();
+
+        data      += count;
+        num_words -= count;
+        offset     = (offset + count) % window_words;
+    }
+
+    return 0;
+}
+
+/**
+ * axi_hbicap_enable_write_empty_interrupt - Enable the write FIFO empty interrupt
+ * @drvdata: a pointer to the drvdata.
+ *
+ * A pending write FIFO empty interrupt is cleared before it is enabled.
+ **/
+void axi_hbicap_enable_write_empty_interrupt(struct hbicap_drvdata *drvdata)
+{
+    u32 pending;
+
+    // IPISR bits toggle on write
+    pending = icap_reg_read(&drvdata->lite_regs, XHI_IPISR_OFFSET);
+    if (pending & XHI_IPIXR_WEMPTY_MASK)
+        icap_reg_write_relaxed(&drvdata->lite_regs, XHI_IPISR_OFFSET, XHI_IPIXR_WEMPTY_MASK);
+
+    icap_reg_update(&drvdata->lite_regs, XHI_IPIER_OFFSET, XHI_IPIXR_WEMPTY_MASK);
+    icap_reg_update(&drvdata->lite_regs, XHI_GIER_OFFSET, XHI_GIER_GIE_MASK);
+}
+
+/**
+ * axi_hbicap_disable_interrupts - Disable all HBICAP interrupts
+ * @drvdata: a pointer to the drvdata.
+ **/
+void axi_hbicap_disable_interrupts(struct hbicap_drvdata *drvdata)
+{
+    icap_reg_update(&drvdata->lite_regs, XHI_GIER_OFFSET, 0);
+    icap_reg_update(&drvdata->lite_regs, XHI_IPIER_OFFSET, 0);
+}
+
+/**
+ * axi_hbicap_irq_handler - Interrupt handler for the write FIFO empty interrupt
+ * @irq:    the interrupt number
+ * @dev_id: a pointer to the drvdata.
+ *
+ * The interrupt stays asserted while the FIFO is empty, so it is disabled again
+ * before the waiting thread is woken up.
+ **/
+irqreturn_t axi_hbicap_irq_handler(int irq, void *dev_id)
+{
+    struct hbicap_drvdata *drvdata = dev_id;
+    u32 pending;
+
+    pending = icap_reg_read(&drvdata->lite_regs, XHI_IPISR_OFFSET);
+    if (!(pending & XHI_IPIXR_WEMPTY_MASK))
+        return IRQ_NONE;
+
+    axi_hbicap_disable_interrupts(drvdata);
+    icap_reg_write_relaxed(&drvdata->lite_regs, XHI_IPISR_OFFSET, pending);
+
+    complete(&drvdata->hbicap_done);
+
+    return IRQ_HANDLED;
 }
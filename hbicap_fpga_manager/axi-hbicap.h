@@ -8,12 +8,16 @@
 #include <linux/types.h>
 #include <linux/cdev.h>
 #include <linux/platform_device.h>
+#include <linux/interrupt.h>
 
 #include <asm/io.h>
 #include "hbicap-fpga.h"
 
-#define iowrite32le(v,p) ({ __iowmb(); __raw_writel((__force __u32) cpu_to_le32(v), p); })
-#define ioread32le(p)    ({ __u32 __v = le32_to_cpu((__force __le32)__raw_readl(p)); __iormb(__v); __v; })
+/**
+ * axi_hbicap_regs_init - Set up the register access of the AXI Lite control registers
+ * @drvdata: a pointer to the drvdata.
+ **/
+void axi_hbicap_regs_init(struct hbicap_drvdata *drvdata);
 
 /**
  * axi_hbicap_reset - Reset the logic of the HBICAP
@@ -31,6 +35,26 @@ void axi_hbicap_reset(struct hbicap_drvdata *drvdata);
  **/
 u32 axi_hbicap_busy(struct hbicap_drvdata *drvdata);
 
+/**
+ * axi_hbicap_start_readback - Start a readback from the ICAP into the read FIFO
+ * @drvdata:   a pointer to the drvdata.
+ * @num_words: the number of 32 bit words to read
+ **/
+void axi_hbicap_start_readback(struct hbicap_drvdata *drvdata, u32 num_words);
+
+/**
+ * axi_hbicap_abort - Abort the current ICAP transaction and reset the HBICAP
+ * @drvdata: a pointer to the drvdata.
+ **/
+void axi_hbicap_abort(struct hbicap_drvdata *drvdata);
+
+/**
+ * axi_hbicap_wait_done - Wait until the ICAP processed the whole transaction.
+ * @drvdata:  a pointer to the drvdata.
+ * @deadline: end of the wait
+ **/
+int axi_hbicap_wait_done(struct hbicap_drvdata *drvdata, ktime_t deadline);
+
 /**
  * axi_hbicap_set_size_register - Set the the size register (number
  * of 32 bit transmission words)
@@ -39,4 +63,35 @@ u32 axi_hbicap_busy(struct hbicap_drvdata *drvdata);
  **/
 void axi_hbicap_set_size_register(struct hbicap_drvdata *drvdata, u32 data);
 
+/**
+ * axi_hbicap_pio_write - Write data from the CPU to the AXI data port
+ * @drvdata:   a pointer to the drvdata.
+ * @data:      the data to write
+ * @num_words: the number of 32 bit words to write
+ * @deadline:  end of the wait for space in the write FIFO
+ *
+ * The size register must be set before. Returns 0 or -ETIMEDOUT.
+ **/
+int axi_hbicap_pio_write(struct hbicap_drvdata *drvdata, const u32 *data,
+                         u32 num_words, ktime_t deadline);
+
+/**
+ * axi_hbicap_enable_write_empty_interrupt - Enable the write FIFO empty interrupt
+ * @drvdata: a pointer to the drvdata.
+ **/
+void axi_hbicap_enable_write_empty_interrupt(struct hbicap_drvdata *drvdata);
+
+/**
+ * axi_hbicap_disable_interrupts - Disable all HBICAP interrupts
+ * @drvdata: a pointer to the drvdata.
+ **/
+void axi_hbicap_disable_interrupts(struct hbicap_drvdata *drvdata);
+
+/**
+ * axi_hbicap_irq_handler - Interrupt handler for the write FIFO empty interrupt
+ * @irq:    the interrupt number
+ * @dev_id: a pointer to the drvdata.
+ **/
+irqreturn_t axi_hbicap_irq_handler(int irq, void *dev_id);
+
 #endif
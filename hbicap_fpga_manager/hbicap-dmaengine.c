@@ -0,0 +1,164 @@
+#include "hbicap-dmaengine.h"
+
+#include <linux/dma-mapping.h>
+
+/**
+ * hbicap_dmaengine_callback - DMA engine completion callback
+ * @param:  the completion slot of the transfer
+ * @result: the result of the transfer
+ **/
+static void hbicap_dmaengine_callback(void *param, const struct dmaengine_result *result)
+{
+    struct hbicap_dma_slot *slot = param;
+
+    slot->result = result ? result->result : DMA_TRANS_NOERROR;
+    complete(&slot->done);
+}
+
+/**
+ * hbicap_dmaengine_setup - Request the DMA channel for the HBICAP data port
+ * @dev:     the HBICAP device
+ * @drvdata: a pointer to the drvdata.
+ * @data_phys_addr: physical address of the AXI data port of the HBICAP
+ *
+ * Returns 0 on success, also if no channel is given in the device tree. In that
+ * case drvdata->dma_chan is NULL and the AXI CDMA registers are used directly.
+ **/
+int hbicap_dmaengine_setup(struct device *dev, struct hbicap_drvdata *drvdata, phys_addr_t data_phys_addr)
+{
+    struct dma_chan *chan;
+    int i;
+
+    drvdata->dma_chan = NULL;
+    drvdata->dma_dev  = dev;
+
+    chan = dma_request_chan(dev, "cdma");
+    if (IS_ERR(chan)) {
+        if (PTR_ERR(chan) == -ENODEV)
+            return 0;
+
+        if (PTR_ERR(chan) != -EPROBE_DEFER)
+            dev_err(dev, "Couldn't request DMA channel\n");
+        return PTR_ERR(chan);
+    }
+
+    if (!dma_has_cap(DMA_MEMCPY, chan->device->cap_mask)) {
+        dev_err(dev, "DMA channel %s can't do memcpy transfers\n", dma_chan_name(chan));
+        dma_release_channel(chan);
+        return -EINVAL;
+    }
+
+    // The AXI data port is the destination of every transfer
+    drvdata->dma_data_addr = dma_map_resource(chan->device->dev, data_phys_addr,
+                                              drvdata->axi_data_size, DMA_BIDIRECTIONAL, 0);
+    if (dma_mapping_error(chan->device->dev, drvdata->dma_data_addr)) {
+        dev_err(dev, "Couldn't map the AXI data port for DMA channel %s\n", dma_chan_name(chan));
+        dma_release_channel(chan);
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < HBICAP_DDR_BUFFERS; i++)
+        init_completion(&drvdata->dma_slots[i].done);
+
+    drvdata->dma_chan = chan;
+    drvdata->dma_dev  = chan->device->dev;
+
+    dev_info(dev, "Using DMA channel %s\n", dma_chan_name(chan));
+
+    return 0;
+}
+
+/**
+ * hbicap_dmaengine_release - Release the DMA channel
+ * @drvdata: a pointer to the drvdata.
+ **/
+void hbicap_dmaengine_release(struct hbicap_drvdata *drvdata)
+{
+    if (!drvdata->dma_chan)
+        return;
+
+    dma_unmap_resource(drvdata->dma_dev, drvdata->dma_data_addr, drvdata->axi_data_size,
+                       DMA_BIDIRECTIONAL, 0);
+    dma_release_channel(drvdata->dma_chan);
+    drvdata->dma_chan = NULL;
+}
+
+/**
+ * hbicap_dmaengine_submit - Queue a transfer from DDR to the AXI data port of the HBICAP
+ * @drvdata: a pointer to the drvdata.
+ * @source_addr: DMA address of the data
+ * @size: the size of the data to be written (in bytes)
+ * @slot: completion slot signaled when the transfer is done, or NULL
+ *
+ * The transfer is started immediately. Transfers without slot are only tracked
+ * by the completion of a later transfer with slot.
+ **/
+int hbicap_dmaengine_submit(struct hbicap_drvdata *drvdata, dma_addr_t source_addr, u32 size,
+                            struct hbicap_dma_slot *slot)
+{
+    struct dma_async_tx_descriptor *tx;
+    dma_cookie_t cookie;
+
+    tx = dmaengine_prep_dma_memcpy(drvdata->dma_chan, drvdata->dma_data_addr, source_addr, size,
+                                   slot ? DMA_PREP_INTERRUPT | DMA_CTRL_ACK : DMA_CTRL_ACK);
+    if (!tx)
+        return -EIO;
+
+    if (slot) {
+        reinit_completion(&slot->done);
+        slot->result  = DMA_TRANS_NOERROR;
+        slot->pending = true;
+        slot->size    = size;
+        tx->callback_result = hbicap_dmaengine_callback;
+        tx->callback_param  = slot;
+    }
+
+    cookie = dmaengine_submit(tx);
+    if (dma_submit_error(cookie)) {
+        if (slot)
+            slot->pending = false;
+        return -EIO;
+    }
+
+    dma_async_issue_pending(drvdata->dma_chan);
+
+    return 0;
+}
+
+/**
+ * hbicap_dmaengine_wait - Wait for the transfer of a completion slot
+ * @drvdata: a pointer to the drvdata.
+ * @slot: the completion slot
+ *
+ * The wait is limited by the time the ICAP needs for the transfer. The transfers
+ * before it in the queue must have been waited for.
+ **/
+int hbicap_dmaengine_wait(struct hbicap_drvdata *drvdata, struct hbicap_dma_slot *slot)
+{
+    u64 budget;
+
+    if (!slot->pending)
+        return 0;
+
+    budget = icap_wait_budget_ns(slot->size, drvdata->icap_clock_hz, drvdata->icap_width);
+    if (!wait_for_completion_timeout(&slot->done, nsecs_to_jiffies(budget)))
+        return -ETIMEDOUT;
+
+    slot->pending = false;
+
+    return (slot->result == DMA_TRANS_NOERROR) ? 0 : -EIO;
+}
+
+/**
+ * hbicap_dmaengine_abort - Stop all queued transfers
+ * @drvdata: a pointer to the drvdata.
+ **/
+void hbicap_dmaengine_abort(struct hbicap_drvdata *drvdata)
+{
+    int i;
+
+    dmaengine_terminate_sync(drvdata->dma_chan);
+
+    for (i = 0; i < HBICAP_DDR_BUFFERS; i++)
+        drvdata->dma_slots[i].pending = false;
+}
@@ -0,0 +1,64 @@
+/**
+* DMA engine client for the AXI HBICAP FPGA manager
+*
+* Instead of programming the AXI lite registers of the AXI CDMA directly (axi-cdma.c),
+* the transfers to the AXI data port of the AXI HBICAP can be submitted to any DMA engine
+* channel with memcpy capability, e.g. the AXI CDMA with the Xilinx DMA engine driver.
+* The channel is taken from the "dmas"/"dma-names" device tree properties.
+**/
+#ifndef HBICAP_DMAENGINE_H_    /* prevent circular inclusions */
+#define HBICAP_DMAENGINE_H_    /* by using protection macros */
+
+#include <linux/types.h>
+#include <linux/dmaengine.h>
+#include <linux/platform_device.h>
+
+#include "hbicap-fpga.h"
+
+/**
+ * hbicap_dmaengine_setup - Request the DMA channel for the HBICAP data port
+ * @dev:     the HBICAP device
+ * @drvdata: a pointer to the drvdata.
+ * @data_phys_addr: physical address of the AXI data port of the HBICAP
+ *
+ * Returns 0 on success, also if no channel is given in the device tree. In that
+ * case drvdata->dma_chan is NULL and the AXI CDMA registers are used directly.
+ **/
+int hbicap_dmaengine_setup(struct device *dev, struct hbicap_drvdata *drvdata, phys_addr_t data_phys_addr);
+
+/**
+ * hbicap_dmaengine_release - Release the DMA channel
+ * @drvdata: a pointer to the drvdata.
+ **/
+void hbicap_dmaengine_release(struct hbicap_drvdata *drvdata);
+
+/**
+ * hbicap_dmaengine_submit - Queue a transfer from DDR to the AXI data port of the HBICAP
+ * @drvdata: a pointer to the drvdata.
+ * @source_addr: DMA address of the data
+ * @size: the size of the data to be written (in bytes)
+ * @slot: completion slot signaled when the transfer is done, or NULL
+ *
+ * The transfer is started immediately. Transfers without slot are only tracked
+ * by the completion of a later transfer with slot.
+ **/
+int hbicap_dmaengine_submit(struct hbicap_drvdata *drvdata, dma_addr_t source_addr, u32 size,
+                            struct hbicap_dma_slot *slot);
+
+/**
+ * hbicap_dmaengine_wait - Wait for the transfer of a completion slot
+ * @drvdata: a pointer to the drvdata.
+ * @slot: the completion slot
+ *
+ * The wait is limited by the time the ICAP needs for the transfer. The transfers
+ * before it in the queue must have been waited for.
+ **/
+int hbicap_dmaengine_wait(struct hbicap_drvdata *drvdata, struct hbicap_dma_slot *slot);
+
+/**
+ * hbicap_dmaengine_abort - Stop all queued transfers
+ * @drvdata: a pointer to the drvdata.
+ **/
+void hbicap_dmaengine_abort(struct hbicap_drvdata *drvdata);
+
+#endif
@@ -8,26 +8,55 @@
 #include <linux/cdev.h>
 #include <linux/platform_device.h>
 #include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/scatterlist.h>
 
 #include "hbicap-fpga.h"
 #include "axi-hbicap.h"
 #include "axi-cdma.h"
+#include "hbicap-dmaengine.h"
+#include "hbicap-pool.h"
+#include "hbicap-readback.h"
 
 
 #include <linux/dma-mapping.h>
+#include <linux/of_reserved_mem.h>
 
 
 #define DRIVER_NAME "hbicap_fpga_manager"
 #define UNIMPLEMENTED 0xFFFF
 
-/* Number of times to poll the done register. This has to be large
- * enough to allow an entire configuration to complete. If an entire
- * page (4kb) is configured at once, that could take up to 4k cycles
- * with a byte-wide icap interface. In most cases, this driver is
- * used with a much smaller fifo, but this should be sufficient in the
- * worst case.
- */
-#define XHI_MAX_RETRIES     5000
+static unsigned int pio_threshold = 4096;
+module_param(pio_threshold, uint, 0444);
+MODULE_PARM_DESC(pio_threshold,
+    "Bitstreams up to this size in bytes are written by the CPU instead of the CDMA (default 4096)");
+
+static bool shared_staging_pool = true;
+module_param(shared_staging_pool, bool, 0444);
+MODULE_PARM_DESC(shared_staging_pool,
+    "Borrow the DDR staging buffers from a pool shared by all devices for each load (default true)");
+
+static bool cached_staging_buffers;
+module_param(cached_staging_buffers, bool, 0444);
+MODULE_PARM_DESC(cached_staging_buffers,
+    "Use cached DDR staging buffers with explicit cache maintenance, also set by xlnx,cached-staging-buffers");
+
+static bool check_crc;
+module_param(check_crc, bool, 0644);
+MODULE_PARM_DESC(check_crc,
+    "Check the configuration CRC of unencrypted bitstreams before they are written (default false)");
+
+static bool verify_load;
+module_param(verify_load, bool, 0644);
+MODULE_PARM_DESC(verify_load,
+    "Check the STAT register of the ICAP for CRC, IDCODE and decryption errors after each load (default false)");
+
+static unsigned int staging_buffer_size = 4096;
+module_param(staging_buffer_size, uint, 0444);
+MODULE_PARM_DESC(staging_buffer_size,
+    "Size of each DDR staging buffer in bytes, overridden by xlnx,staging-buffer-size (default 4096)");
 
 // config registers are based on virtex 6 in the original driver
 static const struct config_registers zynq_usp_config_registers = {
@@ -74,6 +103,131 @@ struct hbicap_fpga_priv {
     struct hbicap_drvdata *drvdata;
 };
 
+/** function hbicap_ddr_buffer_alloc - allocate a DDR buffer for the DMA
+* @drvdata:  hbicap_drvdata struct
+* @phys:     returns the DMA address of the buffer
+* @return virt. address of the buffer or NULL
+*
+* Coherent buffers are mapped uncached. Cached buffers are allocated non-coherent,
+* the CPU writes them at full speed and the cache is cleaned before each transfer.
+*/
+static u32 *hbicap_ddr_buffer_alloc(struct hbicap_drvdata *drvdata, dma_addr_t *phys)
+{
+    if (drvdata->ddr_cached)
+        return dma_alloc_noncoherent(drvdata->dma_dev, drvdata->ddr_size, phys,
+                                     DMA_TO_DEVICE, GFP_KERNEL);
+
+    return dma_alloc_coherent(drvdata->dma_dev, drvdata->ddr_size, phys, GFP_KERNEL);
+}
+
+
+/** function hbicap_ddr_buffer_free - release a DDR buffer allocated with hbicap_ddr_buffer_alloc
+* @drvdata:  hbicap_drvdata struct
+* @virt:     virt. address of the buffer
+* @phys:     DMA address of the buffer
+*/
+static void hbicap_ddr_buffer_free(struct hbicap_drvdata *drvdata, u32 *virt, dma_addr_t phys)
+{
+    if (drvdata->ddr_cached)
+        dma_free_noncoherent(drvdata->dma_dev, drvdata->ddr_size, virt, phys, DMA_TO_DEVICE);
+    else
+        dma_free_coherent(drvdata->dma_dev, drvdata->ddr_size, virt, phys);
+}
+
+
+/** function hbicap_ddr_buffers_put - return the DDR buffers to the shared pool
+* @drvdata:  hbicap_drvdata struct
+*/
+static void hbicap_ddr_buffers_put(struct hbicap_drvdata *drvdata)
+{
+    int i;
+
+    for (i = 0; i < HBICAP_DDR_BUFFERS; i++) {
+        if (!drvdata->ddr_chunks[i])
+            continue;
+
+        dma_unmap_single(drvdata->dma_dev, drvdata->ddr_phys_base_addr[i],
+                         drvdata->ddr_size, DMA_TO_DEVICE);
+        hbicap_pool_put(drvdata->ddr_chunks[i]);
+
+        drvdata->ddr_chunks[i]         = NULL;
+        drvdata->ddr_virt_base_addr[i] = NULL;
+    }
+}
+
+
+/** function hbicap_ddr_buffers_get - borrow the DDR buffers from the shared pool
+* @drvdata:  hbicap_drvdata struct
+* @return 0 if success
+*
+* The chunks are mapped for the DMA device until they are returned with
+* hbicap_ddr_buffers_put. Nothing is done if the buffers are already borrowed
+* or if the device has its own buffers.
+*/
+static int hbicap_ddr_buffers_get(struct hbicap_drvdata *drvdata)
+{
+    struct hbicap_pool_chunk *chunk;
+    bool dma32;
+    int i;
+
+    if (!drvdata->ddr_pooled || drvdata->ddr_chunks[0])
+        return 0;
+
+    dma32 = dma_get_mask(drvdata->dma_dev) <= DMA_BIT_MASK(32);
+
+    for (i = 0; i < HBICAP_DDR_BUFFERS; i++) {
+        chunk = hbicap_pool_get(drvdata->ddr_size, dma32);
+        if (!chunk)
+            goto error;
+
+        drvdata->ddr_phys_base_addr[i] = dma_map_single(drvdata->dma_dev, chunk->virt,
+                                                        drvdata->ddr_size, DMA_TO_DEVICE);
+        if (dma_mapping_error(drvdata->dma_dev, drvdata->ddr_phys_base_addr[i])) {
+            hbicap_pool_put(chunk);
+            goto error;
+        }
+
+        drvdata->ddr_chunks[i]         = chunk;
+        drvdata->ddr_virt_base_addr[i] = chunk->virt;
+    }
+
+    return 0;
+
+error:
+    hbicap_ddr_buffers_put(drvdata);
+    return -ENOMEM;
+}
+
+
+/** function hbicap_release - release the resources of hbicap_setup
+* @data:  hbicap_drvdata struct
+*
+* Runs when the device is removed or the probe fails after the resources were set up.
+* The drvdata itself, the CDMA registers and the interrupts are managed by devm.
+*/
+static void hbicap_release(void *data)
+{
+    struct hbicap_drvdata *drvdata = data;
+    phys_addr_t data_phys_addr = ((phys_addr_t) drvdata->axi_data_phys_base_higher << 32) |
+                                 drvdata->axi_data_phys_base_lower;
+    int i;
+
+    hbicap_ddr_buffers_put(drvdata);
+    for (i = 0; i < HBICAP_DDR_BUFFERS; i++)
+        if (drvdata->ddr_virt_base_addr[i])
+            hbicap_ddr_buffer_free(drvdata, drvdata->ddr_virt_base_addr[i], drvdata->ddr_phys_base_addr[i]);
+    if (drvdata->ddr_reserved_mem)
+        of_reserved_mem_device_release(drvdata->dma_dev);
+    hbicap_dmaengine_release(drvdata);
+
+    iounmap(drvdata->axi_data_virt_base_addr);
+    release_mem_region(data_phys_addr, drvdata->axi_data_size);
+
+    iounmap(drvdata->axi_lite_virt_base_addr);
+    release_mem_region(drvdata->axi_lite_phys_base_addr, drvdata->axi_lite_size);
+}
+
+
 /** function hbicap_setup - helper function to setup the HBICAP IP Core
 * @dev:   device struct
 * @priv:  hbicap_fpga_priv struct
@@ -85,11 +239,14 @@ static int hbicap_setup(struct device *dev, struct hbicap_fpga_priv *priv)
     const struct config_registers *config_regs = &zynq_usp_config_registers;
 
     struct hbicap_drvdata *drvdata = NULL;
+    phys_addr_t data_phys_addr;
+    u32 btt_width;
+    u32 addr_width;
     int retval = 0;
-    dma_addr_t dma_handle;
+    int i;
 
     // Allocate the driver data struct
-    drvdata = kzalloc(sizeof(struct hbicap_drvdata), GFP_KERNEL);
+    drvdata = devm_kzalloc(dev, sizeof(struct hbicap_drvdata), GFP_KERNEL);
     if (!drvdata) {
         retval = -ENOMEM;
         goto failed0;
@@ -112,7 +269,7 @@ static int hbicap_setup(struct device *dev, struct hbicap_fpga_priv *priv)
                     drvdata->axi_lite_size, DRIVER_NAME)) {
         dev_err(dev, "Couldn't lock memory region at %Lx\n",(unsigned long long) res.start);
         retval = -EBUSY;
-        goto failed1;
+        goto failed0;
     }
 
     // Create an virtual address space for the AXI Lite control registers
@@ -122,6 +279,7 @@ static int hbicap_setup(struct device *dev, struct hbicap_fpga_priv *priv)
         retval = -ENOMEM;
         goto failed2;
     }
+    axi_hbicap_regs_init(drvdata);
 
     // Get the AXI data register address and size
     retval = of_address_to_resource(dev->of_node, 1, &res);
@@ -137,10 +295,21 @@ static int hbicap_setup(struct device *dev, struct hbicap_fpga_priv *priv)
     drvdata->axi_data_size             = (u32) resource_size(&res);
 
     // Lock the memory region for the AXI data register
-    if (!request_mem_region(res.start,
+    data_phys_addr = res.start;
+    if (!request_mem_region(data_phys_addr,
                     drvdata->axi_data_size, DRIVER_NAME)) {
         dev_err(dev, "Couldn't lock memory region at %Lx\n",(unsigned long long) res.start);
         retval = -EBUSY;
+        goto failed3;
+    }
+
+    // Map the AXI data registers for writes from the CPU. The window is the data port
+    // of a FIFO, so it is mapped as device memory: the CPU then neither reorders nor
+    // merges the writes, which a write-combined mapping may do on arm64.
+    drvdata->axi_data_virt_base_addr = ioremap(data_phys_addr, drvdata->axi_data_size);
+    if (!drvdata->axi_data_virt_base_addr) {
+        dev_err(dev, "ioremap() for AXI data registers failed\n");
+        retval = -ENOMEM;
         goto failed4;
     }
 
@@ -151,18 +320,120 @@ static int hbicap_setup(struct device *dev, struct hbicap_fpga_priv *priv)
 
     mutex_init(&drvdata->sem);
 
-    // Allocate a 4k buffer in the DDR for the DMA
-    // TODO: It may be better to do this in the hbicap_fpga_ops_write_init function and
-    // release the memory in the hbicap_fpga_ops_write_complete function. It may also be
-    // better to allocate memory for the whole bitstream and not just a 4k chunk. In
-    // addition the memory must be in the lower 2G of the PS DDR to be accessible from
-    // the PL.
-    drvdata->ddr_size           = 4096;
-    drvdata->ddr_virt_base_addr = dma_alloc_coherent(dev, 4096, &dma_handle, __GFP_DMA);
-    drvdata->ddr_phys_base_addr = (u32 *) dma_handle;
+    // The ICAP clock and width limit the time budget of all waits for the hardware
+    drvdata->icap_clock_hz = ICAP_DEFAULT_CLOCK_HZ;
+    drvdata->icap_width    = ICAP_DEFAULT_WIDTH;
+    of_property_read_u32(dev->of_node, "xlnx,icap-clock-frequency", &drvdata->icap_clock_hz);
+    of_property_read_u32(dev->of_node, "xlnx,icap-width", &drvdata->icap_width);
+    if (!drvdata->icap_clock_hz ||
+        (drvdata->icap_width != 8 && drvdata->icap_width != 16 && drvdata->icap_width != 32)) {
+        dev_err(dev, "Invalid ICAP clock or width in device tree\n");
+        retval = -EINVAL;
+        goto failed4;
+    }
+
+    // Use a DMA engine channel for the transfers if one is given in the device tree
+    retval = hbicap_dmaengine_setup(dev, drvdata, data_phys_addr);
+    if (retval)
+        goto failed4;
+
+    // Without a DMA engine channel and without the CDMA registers all bitstreams are
+    // written by the CPU. Otherwise only bitstreams up to the threshold are, since for
+    // them setting up the CDMA takes longer than the transfer.
+    drvdata->pio_only = !drvdata->dma_chan && of_address_to_resource(dev->of_node, 2, &res);
+    drvdata->pio_threshold = pio_threshold;
+    of_property_read_u32(dev->of_node, "xlnx,pio-threshold", &drvdata->pio_threshold);
+
+    // Without key hole writes the CDMA increments the destination address, so a single
+    // transfer must stay inside the AXI data window of the HBICAP. With key hole writes
+    // every transfer goes to the base address of the window and is only limited by the
+    // width of the CDMA bytes to transfer register.
+    btt_width = XAXICDMA_DEFAULT_BTT_WIDTH;
+    of_property_read_u32(dev->of_node, "xlnx,cdma-btt-width", &btt_width);
+    drvdata->cdma_key_hole_write = of_property_read_bool(dev->of_node, "xlnx,cdma-key-hole-write");
+    if (drvdata->cdma_key_hole_write && drvdata->dma_chan) {
+        dev_warn(dev, "Key hole writes are not supported with a DMA engine channel\n");
+        drvdata->cdma_key_hole_write = false;
+    }
+    if (drvdata->cdma_key_hole_write)
+        drvdata->max_transfer_size = axi_cdma_max_transfer_size(btt_width);
+    else
+        drvdata->max_transfer_size = drvdata->axi_data_size;
+
+    // The size of the DDR buffers is given by the device tree or the module parameter
+    drvdata->ddr_size = staging_buffer_size;
+    of_property_read_u32(dev->of_node, "xlnx,staging-buffer-size", &drvdata->ddr_size);
+    if (drvdata->ddr_size < 4 || !IS_ALIGNED(drvdata->ddr_size, 4)) {
+        dev_err(dev, "Invalid staging buffer size %u\n", drvdata->ddr_size);
+        retval = -EINVAL;
+        goto failed5;
+    }
+    if (drvdata->ddr_size > drvdata->max_transfer_size) {
+        dev_warn(dev, "Staging buffer size %u limited to the maximum transfer size %u\n",
+                 drvdata->ddr_size, drvdata->max_transfer_size);
+        drvdata->ddr_size = drvdata->max_transfer_size;
+    }
+
+    if (!drvdata->dma_chan && !drvdata->pio_only) {
+        // The CDMA reaches the DDR with xlnx,cdma-addr-width address bits
+        addr_width = 32;
+        of_property_read_u32(dev->of_node, "xlnx,cdma-addr-width", &addr_width);
+        if (addr_width < 32 || addr_width > 64) {
+            dev_err(dev, "Invalid CDMA address width %u\n", addr_width);
+            retval = -EINVAL;
+            goto failed5;
+        }
+
+        retval = dma_set_mask_and_coherent(dev, DMA_BIT_MASK(addr_width));
+        if (retval) {
+            dev_err(dev, "Couldn't set the DMA mask to %u bits\n", addr_width);
+            goto failed5;
+        }
+
+        // Take the DDR buffers from a reserved memory pool if a memory-region is given
+        retval = of_reserved_mem_device_init(dev);
+        if (retval && retval != -ENODEV) {
+            dev_err(dev, "Couldn't initialize the reserved memory region\n");
+            goto failed5;
+        }
+        drvdata->ddr_reserved_mem = !retval;
+        retval = 0;
+    }
+
+    // The DDR buffers for the DMA are borrowed from the shared pool for each load.
+    // Devices with a reserved memory region or without the shared pool allocate
+    // their own buffers once. While the CDMA is busy with one buffer, the next
+    // chunk of the bitstream is copied into the other one.
+    drvdata->ddr_pooled = shared_staging_pool && !drvdata->ddr_reserved_mem && !drvdata->pio_only;
+    drvdata->ddr_cached = cached_staging_buffers ||
+                          of_property_read_bool(dev->of_node, "xlnx,cached-staging-buffers");
+    if (drvdata->ddr_cached && drvdata->ddr_reserved_mem) {
+        dev_warn(dev, "Cached staging buffers are not supported with a reserved memory region\n");
+        drvdata->ddr_cached = false;
+    }
+
+    for (i = 0; i < HBICAP_DDR_BUFFERS && !drvdata->ddr_pooled && !drvdata->pio_only; i++) {
+        drvdata->ddr_virt_base_addr[i] = hbicap_ddr_buffer_alloc(drvdata, &drvdata->ddr_phys_base_addr[i]);
+        if (!drvdata->ddr_virt_base_addr[i]) {
+            dev_err(dev, "Couldn't allocate DDR buffer %d\n", i);
+            retval = -ENOMEM;
+            goto failed5;
+        }
 
-    dev_info(dev, "4k DDR buffer is at 0x%p\n", drvdata->ddr_phys_base_addr);
-    dev_info(dev, "WARNING: The DDR buffer must be in the lower 2GB of the memory. ToDo: Make sure this is always the case.\n");
+        dev_info(dev, "%u byte DDR buffer %d is at %pad\n", drvdata->ddr_size, i,
+                 &drvdata->ddr_phys_base_addr[i]);
+    }
+    if (drvdata->ddr_pooled)
+        dev_info(dev, "%u byte DDR buffers are borrowed from the shared pool\n", drvdata->ddr_size);
+    if (drvdata->ddr_reserved_mem)
+        dev_info(dev, "DDR buffers are allocated from the reserved memory region\n");
+    if (drvdata->ddr_cached && !drvdata->ddr_pooled)
+        dev_info(dev, "DDR buffers are cached, the cache is maintained before each transfer\n");
+
+    // From here on the buffers, the DMA channel and the HBICAP registers are released with the device
+    retval = devm_add_action_or_reset(dev, hbicap_release, drvdata);
+    if (retval)
+        return retval;
 
     dev_dbg(dev, "AXI Lite ioremap %llx to %p with size %llx\n",
         (unsigned long long) drvdata->axi_lite_phys_base_addr,
@@ -170,25 +441,78 @@ static int hbicap_setup(struct device *dev, struct hbicap_fpga_priv *priv)
         (unsigned long long) drvdata->axi_lite_size);
 
 
-    // Hack to set the base address of the AXI CDMA AXI Lite registers
-    // As previously mentioned in the header the AXI CDMA stuff should be in a
-    // separate driver
+    // The interrupts are optional. Without them the status registers are polled.
+    init_completion(&drvdata->cdma_done);
+    init_completion(&drvdata->hbicap_done);
 
-    // Get the AXI data register address and size
-    retval = of_address_to_resource(dev->of_node, 2, &res);
-    if (retval) {
-        dev_err(dev, "Invalid CDMA AXI Lite address in device tree\n");
-        goto failed4;
+    // With a DMA engine channel, the AXI CDMA belongs to its DMA engine driver
+    if (!drvdata->dma_chan && !drvdata->pio_only) {
+        // Hack to set the base address of the AXI CDMA AXI Lite registers
+        // As previously mentioned in the header the AXI CDMA stuff should be in a
+        // separate driver
+
+        // Get the AXI data register address and size
+        retval = of_address_to_resource(dev->of_node, 2, &res);
+        if (retval) {
+            dev_err(dev, "Invalid CDMA AXI Lite address in device tree\n");
+            return retval;
+        }
+
+        drvdata->cdma_virt_base_addr = devm_ioremap(dev, res.start, resource_size(&res));
+        if (!drvdata->cdma_virt_base_addr) {
+            dev_err(dev, "ioremap() for CDMA AXI Lite registers failed\n");
+            return -ENOMEM;
+        }
+        dev_dbg(dev, "AXI CDMA virtual base address:  0x%p", drvdata->cdma_virt_base_addr);
+        axi_cdma_regs_init(drvdata);
+
+        // Use the scatter gather engine of the CDMA if it is available
+        drvdata->cdma_sg_included = axi_cdma_sg_included(drvdata);
+        dev_info(dev, "AXI CDMA %s scatter gather engine\n",
+                 drvdata->cdma_sg_included ? "with" : "without");
+
+        drvdata->cdma_irq = platform_get_irq_byname_optional(to_platform_device(dev), "cdma");
+        if (drvdata->cdma_irq > 0) {
+            retval = devm_request_irq(dev, drvdata->cdma_irq, axi_cdma_irq_handler,
+                                      0, DRIVER_NAME, drvdata);
+            if (retval) {
+                dev_err(dev, "Couldn't request CDMA interrupt %d\n", drvdata->cdma_irq);
+                return retval;
+            }
+        }
+    }
+
+    drvdata->hbicap_irq = platform_get_irq_byname_optional(to_platform_device(dev), "hbicap");
+    if (drvdata->hbicap_irq > 0) {
+        axi_hbicap_disable_interrupts(drvdata);
+        retval = devm_request_irq(dev, drvdata->hbicap_irq, axi_hbicap_irq_handler,
+                                  0, DRIVER_NAME, drvdata);
+        if (retval) {
+            dev_err(dev, "Couldn't request HBICAP interrupt %d\n", drvdata->hbicap_irq);
+            return retval;
+        }
     }
 
-    drvdata->cdma_virt_base_addr = ioremap(res.start, resource_size(&res));
-    dev_dbg(dev, "AXI CDMA virtual base address:  0x%p", drvdata->cdma_virt_base_addr);
+    if (drvdata->pio_only)
+        dev_info(dev, "No CDMA, all bitstreams are written by the CPU\n");
+    else
+        dev_info(dev, "Bitstreams up to %u bytes are written by the CPU\n", drvdata->pio_threshold);
+
+    dev_info(dev, "CDMA completion by %s, HBICAP completion by %s\n",
+             drvdata->dma_chan ? "DMA engine" : drvdata->cdma_irq > 0 ? "interrupt" : "polling",
+             drvdata->hbicap_irq > 0 ? "interrupt" : "polling");
 
     priv->drvdata = drvdata;
     return 0;    /* success */
 
+failed5:
+    hbicap_release(drvdata);
+    return retval;
+
 failed4:
-    release_mem_region(res.start, drvdata->axi_data_size);
+    if (drvdata->axi_data_virt_base_addr)
+        iounmap(drvdata->axi_data_virt_base_addr);
+    release_mem_region(data_phys_addr, drvdata->axi_data_size);
 
 failed3:
     iounmap(drvdata->axi_lite_virt_base_addr);
@@ -196,9 +520,6 @@ failed3:
 failed2:
     release_mem_region(drvdata->axi_lite_phys_base_addr, drvdata->axi_lite_size);
 
-failed1:
-    kfree(drvdata);
-
 failed0:
 
     return retval;
@@ -229,6 +550,9 @@ static int hbicap_fpga_ops_write_init(struct fpga_manager *mgr,
     struct hbicap_fpga_priv *priv;
     int eemi_flags = 0;
     struct hbicap_drvdata *drvdata;
+    const u8 *header;
+    ssize_t len;
+    int status;
 
     mgr->state = FPGA_MGR_STATE_WRITE_INIT;
 
@@ -257,182 +581,1534 @@ static int hbicap_fpga_ops_write_init(struct fpga_manager *mgr,
         return -EINVAL;
     }
 
+    // The setup of the load changes the state shared with the readback
+    status = mutex_lock_interruptible(&drvdata->sem);
+    if (status) {
+        mgr->state = FPGA_MGR_STATE_WRITE_INIT_ERR;
+        return status;
+    }
+
+    // A running readback owns the HBICAP until its file is closed
+    if (drvdata->readback_active) {
+        dev_err(&mgr->dev, "Readback in progress, can't load a bitstream\n");
+        status = -EBUSY;
+        goto failed_unlock;
+    }
+
+    // The STAT register is read with the CDMA, the load fails before it starts if it can't be
+    if (verify_load && !drvdata->query_buf) {
+        dev_err(&mgr->dev, "verify_load needs the CDMA registers, the load can't be verified\n");
+        status = -EOPNOTSUPP;
+        goto failed_unlock;
+    }
+
+    // Compressed bitstreams are parsed from their decompressed start
+    icap_unzstd_free(&drvdata->unzstd);
+    header = (const u8 *) buf;
+    if (icap_unzstd_detect(header, size)) {
+        status = icap_unzstd_init(&drvdata->unzstd, header, size);
+        if (!status) {
+            len = icap_unzstd_peek(&drvdata->unzstd, header, size,
+                                   drvdata->pio_stage, sizeof(drvdata->pio_stage));
+            status = (len < 0) ? len : 0;
+        }
+        if (status) {
+            dev_err(&mgr->dev, "Can't decompress the bitstream (%d)\n", status);
+            goto failed_free;
+        }
+        dev_dbg(&mgr->dev, "zstd compressed bitstream, %llu bytes\n", drvdata->unzstd.size);
+
+        header = (const u8 *) drvdata->pio_stage;
+        size   = len;
+    }
+
+    // Find the sync word and the byte order of .bit and .bin files
+    if (icap_bitstream_parse(header, size, &drvdata->skip_bytes, &drvdata->swap)) {
+        dev_err(&mgr->dev, "No sync word in the .bit file\n");
+        status = -EINVAL;
+        goto failed_free;
+    }
+    dev_dbg(&mgr->dev, "Sync word at %zu, swap %d\n", drvdata->skip_bytes, drvdata->swap);
+
+    // A compressed bitstream is written as one transaction, its size is known upfront
+    if (drvdata->unzstd.stream) {
+        if ((drvdata->unzstd.size - drvdata->skip_bytes) & 3 ||
+            (drvdata->unzstd.size - drvdata->skip_bytes) >> 2 > U32_MAX) {
+            dev_err(&mgr->dev, "Decompressed bitstream size is not a multiple of 4\n");
+            status = -EINVAL;
+            goto failed_free;
+        }
+        drvdata->unpack_words   = (drvdata->unzstd.size - drvdata->skip_bytes) >> 2;
+        drvdata->unpack_started = false;
+        drvdata->unpack_buffer  = 0;
+    }
+    drvdata->write_buffer_in_use = 0;
+
     // HBICAP Initialising
     dev_dbg(&mgr->dev, "Initializing HBICAP...\n");
 
+    // Count the register accesses of this load
+    icap_regs_reset_stats(&drvdata->lite_regs);
+    icap_regs_reset_stats(&drvdata->cdma_regs);
+
     // Reset the HBICAP to have a defined state
     dev_dbg(&mgr->dev, "Reset...\n");
     axi_hbicap_reset(drvdata);
 
+    // Return DDR buffers still borrowed by a load that failed
+    hbicap_ddr_buffers_put(drvdata);
+
+    // Reset the copy statistics of the last load
+    drvdata->copy_time_ns        = 0;
+    drvdata->copy_time_hidden_ns = 0;
+
+    // The CRC of encrypted bitstreams is computed over the decrypted data
+    drvdata->crc_check = check_crc && !(priv->flags &
+            (FPGA_MGR_ENCRYPTED_BITSTREAM | FPGA_MGR_USERKEY_ENCRYPTED_BITSTREAM));
+    if (drvdata->crc_check)
+        icap_crc_init(&drvdata->crc, drvdata->config_regs, true);
+
     // In the original HWICAP char driver at this stage a desync
     // package was send to the HWICAP followed by reading the 
     // IDCODE and sending another desync package.
     // It seams that with the ICAP3 interface on Ultrascale+
     // this is no longer necessary.
 
+    // Readbacks can't start until the load is complete or failed
+    drvdata->load_active = true;
+    mutex_unlock(&drvdata->sem);
+
     return 0;
+
+failed_free:
+    icap_unzstd_free(&drvdata->unzstd);
+failed_unlock:
+    mutex_unlock(&drvdata->sem);
+    mgr->state = FPGA_MGR_STATE_WRITE_INIT_ERR;
+    return status;
 }
 
 
-/** function hbicap_fpga_ops_write - write count bytes of configuration data to the FPGA
-* @mgr:   fpga_manager struct
-* @buf:   contiguous buffer containing FPGA image
-* @size:  size of buf
+/** function hbicap_wait_for_done - wait until the HBICAP has processed the whole transaction
+* @drvdata:  hbicap_drvdata struct
+* @pending:  number of bytes that may still be in the HBICAP
 * @return 0 if success
+*
+* This checks if the number of 32 bit words specified with the size register are received
+* or if some transmissions are still outstanding. The wait is limited by the time the ICAP
+* needs for the pending bytes.
 */
-static int hbicap_fpga_ops_write(struct fpga_manager *mgr,
-                 const char *buf, size_t size)
+static int hbicap_wait_for_done(struct hbicap_drvdata *drvdata, u32 pending)
 {
-    struct hbicap_fpga_priv *priv;
-    struct hbicap_drvdata *drvdata;
-    ssize_t written = 0;
-    ssize_t left = size;
-    ssize_t len;
-    ssize_t status;
-    u32 retries = 0;
-
-    mgr->state = FPGA_MGR_STATE_WRITE;
-
-    priv = mgr->priv;
-    drvdata = priv->drvdata;
-
-    status = mutex_lock_interruptible(&drvdata->sem);
-    if (status) {
-        mgr->state = FPGA_MGR_STATE_WRITE_ERR;
-        goto error;
+    u64 budget = icap_wait_budget_ns(pending, drvdata->icap_clock_hz, drvdata->icap_width);
+    ktime_t deadline = ktime_add_ns(ktime_get(), budget);
+
+    // Sleep until the write FIFO is empty, the ICAP is done shortly afterwards.
+    // If the FIFO drained before the interrupt was enabled, the timeout ends the
+    // wait and the done bit is polled as without interrupt.
+    if (drvdata->hbicap_irq > 0 && axi_hbicap_busy(drvdata)) {
+        reinit_completion(&drvdata->hbicap_done);
+        axi_hbicap_enable_write_empty_interrupt(drvdata);
+
+        if (axi_hbicap_busy(drvdata))
+            wait_for_completion_timeout(&drvdata->hbicap_done, nsecs_to_jiffies(budget));
+        axi_hbicap_disable_interrupts(drvdata);
     }
 
-    // Write the number of 32 bit words of the bitstream to the AXI HBICAP
-    axi_hbicap_set_size_register(drvdata, size >> 2);
+    return axi_hbicap_wait_done(drvdata, deadline);
+}
 
-    // Write the bitstream in chunks of 4k to the AXI HBICAP
-    while (left > 0) {
-        len = ((left < 4096) ? left : 4096);
 
-        // Copy from buf to DDR
-        memcpy(drvdata->ddr_virt_base_addr, buf + written, len);
+// Position in a bitstream that is staged by the CPU, either a buffer or a scatter list table
+struct hbicap_source {
+    u8 head[4];                         /* bytes of an incomplete word of the last write, read first */
+    u32 head_len;                       /* bytes left in head */
+    const char *buf;                    /* contiguous bitstream, NULL for a scatter list table */
+    struct sg_mapping_iter miter;       /* position in the scatter list table */
+};
 
-        // Write the data to the AXI HBICAP via the AXI CDMA
-        status = axi_cdma_write(drvdata, 0, (u32) drvdata->ddr_phys_base_addr,
-            drvdata->axi_data_phys_base_higher, drvdata->axi_data_phys_base_lower, len);
 
-        // Check if the transmission was sucessfull
-        if(status) {
-            dev_err(&mgr->dev, "CDMA transmission was not successfull\n");
-            goto error;
+/** function hbicap_source_read - copy the next bytes of the bitstream
+* @src:  position in the bitstream
+* @dst:  destination, the bytes are skipped if NULL
+* @len:  number of bytes
+*/
+static void hbicap_source_read(struct hbicap_source *src, void *dst, size_t len)
+{
+    struct sg_mapping_iter *miter = &src->miter;
+    size_t n;
+
+    n = min_t(size_t, len, src->head_len);
+    if (n) {
+        if (dst) {
+            memcpy(dst, src->head + 4 - src->head_len, n);
+            dst += n;
         }
+        src->head_len -= n;
+        len -= n;
+    }
 
-        // update written and left counter
-        written += len;
-        left -= len;
+    if (src->buf) {
+        if (dst)
+            memcpy(dst, src->buf, len);
+        src->buf += len;
+        return;
     }
 
-    // Wait until the write has finished.
-    // This checks if the number of 32 bit words specified with the size register are received
-    // or if some transmissions are still outstanding.
-        while (axi_hbicap_busy(drvdata)) {
-            retries++;
-            if (retries > XHI_MAX_RETRIES) {
-                return -42;
-            }
+    while (len) {
+        if (miter->consumed == miter->length) {
+            if (!sg_miter_next(miter))
+                break;
+            miter->consumed = 0;
         }
 
-    //check if the whole bitstream was written
-    status = (size - written);
+        n = min_t(size_t, len, miter->length - miter->consumed);
+        if (dst) {
+            memcpy(dst, miter->addr + miter->consumed, n);
+            dst += n;
+        }
+        miter->consumed += n;
+        len -= n;
+    }
+}
 
- error:
-    mutex_unlock(&drvdata->sem);
 
-    return status;
+/** function hbicap_copy_to_buffer - copy a chunk of the bitstream into a DDR buffer
+* @drvdata:  hbicap_drvdata struct
+* @buffer:   index of the DDR buffer
+* @src:      position in the bitstream
+* @len:      number of bytes to copy
+*
+* The buffer must not be transferred at the moment. The words are converted into the
+* order of the ICAP in the buffer. Cached and pooled buffers are handed back to the
+* device afterwards, which cleans the written cache lines to the DDR.
+*/
+static void hbicap_copy_to_buffer(struct hbicap_drvdata *drvdata, int buffer,
+                                  struct hbicap_source *src, u32 len)
+{
+    if (drvdata->ddr_cached || drvdata->ddr_pooled)
+        dma_sync_single_for_cpu(drvdata->dma_dev, drvdata->ddr_phys_base_addr[buffer],
+                                len, DMA_TO_DEVICE);
+
+    hbicap_source_read(src, drvdata->ddr_virt_base_addr[buffer], len);
+    icap_swap_words(drvdata->ddr_virt_base_addr[buffer], len >> 2, drvdata->swap);
+
+    if (drvdata->ddr_cached || drvdata->ddr_pooled)
+        dma_sync_single_for_device(drvdata->dma_dev, drvdata->ddr_phys_base_addr[buffer],
+                                   len, DMA_TO_DEVICE);
 }
 
 
-/** function hbicap_fpga_ops_write_complete - set FPGA to operating state after writing is done
-* @mgr:   fpga_manager struct
-* @info:  fpga_image_info struct
+/** function hbicap_buffer_wait - wait until the transfer of a DDR buffer is finished
+* @drvdata:  hbicap_drvdata struct
+* @buffer:   index of the DDR buffer
 * @return 0 if success
 */
-int hbicap_fpga_ops_write_complete(struct fpga_manager *mgr, struct fpga_image_info *info)
+static int hbicap_buffer_wait(struct hbicap_drvdata *drvdata, int buffer)
 {
-    // mgr->state = FPGA_MGR_STATE_WRITE_COMPLETE;
-	mgr->state = FPGA_MGR_STATE_OPERATING;
-    return 0;
-}
+    struct hbicap_dma_slot *slot = &drvdata->dma_slots[buffer];
 
+    if (drvdata->dma_chan)
+        return hbicap_dmaengine_wait(drvdata, slot);
 
-/**
-* struct hbicap_fpga_ops - ops for low level fpga manager drivers
-* @write_init:     prepare the FPGA to receive configuration data
-* @write:          write count bytes of configuration data to the FPGA
-* @write_complete: set FPGA to operating state after writing is done
-* @state:          returns an enum value of the FPGA's state
-*/
-static const struct fpga_manager_ops hbicap_fpga_ops = {
-    .write_init     = hbicap_fpga_ops_write_init,
-    .write          = hbicap_fpga_ops_write,
-    .write_complete = hbicap_fpga_ops_write_complete,
-    .state          = hbicap_fpga_ops_state,
-};
+    if (!slot->pending)
+        return 0;
 
+    slot->pending = false;
+    return axi_cdma_wait_write(drvdata);
+}
 
-/** function hbicap_fpga_probe - probe function
-* @pdev:  platform_device struct
+
+/** function hbicap_buffer_start - start the transfer of a DDR buffer to the AXI HBICAP
+* @drvdata:  hbicap_drvdata struct
+* @buffer:   index of the DDR buffer
+* @len:      number of bytes in the buffer
 * @return 0 if success
+*
+* A DMA engine channel queues the transfer behind the running ones. The AXI CDMA
+* registers only hold one transfer, so the previous one is waited for first.
 */
-static int hbicap_fpga_probe(struct platform_device *pdev)
+static int hbicap_buffer_start(struct hbicap_drvdata *drvdata, int buffer, u32 len)
 {
-    struct device *dev;
-    struct hbicap_fpga_priv *priv;
-    struct fpga_manager *mgr;
-    int ret;
+    struct hbicap_dma_slot *slot = &drvdata->dma_slots[buffer];
+    int status;
+    int i;
 
-    dev = &pdev->dev;
+    if (drvdata->dma_chan)
+        return hbicap_dmaengine_submit(drvdata, drvdata->ddr_phys_base_addr[buffer], len, slot);
 
-    priv = devm_kzalloc(dev, sizeof(*priv), GFP_KERNEL);
-    if (!priv)
-        return -ENOMEM;
+    for (i = 0; i < HBICAP_DDR_BUFFERS; i++) {
+        status = hbicap_buffer_wait(drvdata, i);
+        if (status)
+            return status;
+    }
 
-    // Only support partial reconfiguration
-    priv->feature_list = FPGA_MGR_PARTIAL_RECONFIG;
+    status = axi_cdma_start_write(drvdata, upper_32_bits(drvdata->ddr_phys_base_addr[buffer]),
+        lower_32_bits(drvdata->ddr_phys_base_addr[buffer]),
+        drvdata->axi_data_phys_base_higher, drvdata->axi_data_phys_base_lower, len);
+    if (!status)
+        slot->pending = true;
 
-    // HBICAP Setup
-    ret = hbicap_setup(&pdev->dev, priv);
-    if (ret) {
-        dev_err(&pdev->dev, "Error in hbicap_setup\n");
-        return ret;
+    return status;
+}
+
+
+/** function hbicap_buffers_running - check if a DDR buffer transfer is still running
+* @drvdata:  hbicap_drvdata struct
+* @return true if a transfer has not finished yet
+*
+* Transfers that finished but were not waited for yet don't count. Without DMA engine
+* channel or CDMA interrupt, this would need a register read, so a pending transfer is
+* taken as running.
+*/
+static bool hbicap_buffers_running(struct hbicap_drvdata *drvdata)
+{
+    int i;
+
+    for (i = 0; i < HBICAP_DDR_BUFFERS; i++) {
+        if (!drvdata->dma_slots[i].pending)
+            continue;
+        if (drvdata->dma_chan) {
+            if (!completion_done(&drvdata->dma_slots[i].done))
+                return true;
+        }
+        else if (drvdata->cdma_irq <= 0 || !completion_done(&drvdata->cdma_done)) {
+            return true;
+        }
     }
 
-    mgr = devm_fpga_mgr_create(dev, "Xilinx HBICAP FPGA Manager",
-                    &hbicap_fpga_ops, priv);
+    return false;
+}
 
-    if (IS_ERR(mgr))
-        return PTR_ERR(mgr);
 
-    mgr->state = FPGA_MGR_STATE_OPERATING;
+/** function hbicap_buffers_abort - forget all pending DDR buffer transfers after an error
+* @drvdata:  hbicap_drvdata struct
+*/
+static void hbicap_buffers_abort(struct hbicap_drvdata *drvdata)
+{
+    int i;
 
-    return devm_fpga_mgr_register(dev, mgr);
+    if (drvdata->dma_chan) {
+        hbicap_dmaengine_abort(drvdata);
+        return;
+    }
+
+    axi_cdma_reset(drvdata);
+    for (i = 0; i < HBICAP_DDR_BUFFERS; i++)
+        drvdata->dma_slots[i].pending = false;
 }
 
 
-#ifdef CONFIG_OF
-/* Match table for device tree binding */
-static const struct of_device_id hbicap_fpga_of_match[] = {
-    { .compatible = "xlnx,hbicap-fpga", },
-    {},
-};
-MODULE_DEVICE_TABLE(of, hbicap_fpga_of_match);
-#endif
+/** function hbicap_dmaengine_write_chunks - write a mapped scatter list table through the DMA engine
+* @mgr:   fpga_manager struct
+* @sgt:   DMA mapped scatter list table containing FPGA image
+* @return 0 if success
+*
+* The transfers take the completion slots in turn, so up to HBICAP_DDR_BUFFERS of them
+* are queued. A slot is waited for before it is used again, so the result of every
+* transfer is checked.
+*/
+static int hbicap_dmaengine_write_chunks(struct fpga_manager *mgr, struct sg_table *sgt)
+{
+    struct hbicap_fpga_priv *priv = mgr->priv;
+    struct hbicap_drvdata *drvdata = priv->drvdata;
+    struct hbicap_dma_slot *slot;
+    struct scatterlist *sg;
+    dma_addr_t addr;
+    u32 next = 0;
+    u32 left;
+    u32 len;
+    int status;
+    int i;
+
+    for_each_sgtable_dma_sg(sgt, sg, i) {
+        addr = sg_dma_address(sg);
+        left = sg_dma_len(sg);
+
+        while (left > 0) {
+            len  = min(left, drvdata->axi_data_size);
+            slot = &drvdata->dma_slots[next];
+            next = (next + 1) % HBICAP_DDR_BUFFERS;
+
+            status = hbicap_dmaengine_wait(drvdata, slot);
+            if (status)
+                goto error;
+
+            status = hbicap_dmaengine_submit(drvdata, addr, len, slot);
+            if (status)
+                goto error;
+
+            addr += len;
+            left -= len;
+        }
+    }
 
-static struct platform_driver hbicap_fpga_driver = {
-    .probe = hbicap_fpga_probe,
-    .driver = {
-        .name = DRIVER_NAME,
-        .of_match_table = of_match_ptr(hbicap_fpga_of_match),
-    },
-};
+    // The oldest transfer is in the next slot
+    for (i = 0; i < HBICAP_DDR_BUFFERS; i++) {
+        status = hbicap_dmaengine_wait(drvdata, &drvdata->dma_slots[next]);
+        if (status)
+            goto error;
+        next = (next + 1) % HBICAP_DDR_BUFFERS;
+    }
+
+    return 0;
 
+error:
+    dev_err(&mgr->dev, "DMA engine transmission was not successfull\n");
+    hbicap_dmaengine_abort(drvdata);
 
-module_platform_driver(hbicap_fpga_driver);
+    return status;
+}
+
+
+/** function hbicap_cdma_write_chain - write a mapped scatter list table with one descriptor chain
+* @mgr:   fpga_manager struct
+* @sgt:   DMA mapped scatter list table containing FPGA image
+* @return 0 if success
+*
+* The CDMA processes the whole chain after a single start, instead of being programmed
+* for every transfer.
+*/
+static int hbicap_cdma_write_chain(struct fpga_manager *mgr, struct sg_table *sgt)
+{
+    struct hbicap_fpga_priv *priv = mgr->priv;
+    struct hbicap_drvdata *drvdata = priv->drvdata;
+    struct axi_cdma_sg_chain chain;
+    struct scatterlist *sg;
+    u64 destination_addr;
+    dma_addr_t addr;
+    u32 count = 0;
+    u32 left;
+    u32 len;
+    int status;
+    int i;
+
+    destination_addr = ((u64) drvdata->axi_data_phys_base_higher << 32) | drvdata->axi_data_phys_base_lower;
+
+    // One descriptor per max_transfer_size bytes of a segment
+    for_each_sgtable_dma_sg(sgt, sg, i)
+        count += DIV_ROUND_UP(sg_dma_len(sg), drvdata->max_transfer_size);
+
+    status = axi_cdma_sg_chain_alloc(drvdata->dma_dev, &chain, count);
+    if (status) {
+        dev_err(&mgr->dev, "Couldn't allocate %u CDMA descriptors\n", count);
+        return status;
+    }
+
+    for_each_sgtable_dma_sg(sgt, sg, i) {
+        addr = sg_dma_address(sg);
+        left = sg_dma_len(sg);
+
+        while (left > 0) {
+            len = min(left, drvdata->max_transfer_size);
+
+            status = axi_cdma_sg_chain_add(&chain, addr, destination_addr, len);
+            if (status)
+                goto error;
+
+            addr += len;
+            left -= len;
+        }
+    }
+
+    status = axi_cdma_sg_write(drvdata, &chain);
+    if (status)
+        dev_err(&mgr->dev, "CDMA descriptor chain was not successfull\n");
+
+error:
+    axi_cdma_sg_chain_free(&chain);
+
+    return status;
+}
+
+
+/** function hbicap_cdma_write_simple - write a mapped scatter list table transfer by transfer
+* @mgr:   fpga_manager struct
+* @sgt:   DMA mapped scatter list table containing FPGA image
+* @return 0 if success
+*/
+static int hbicap_cdma_write_simple(struct fpga_manager *mgr, struct sg_table *sgt)
+{
+    struct hbicap_fpga_priv *priv = mgr->priv;
+    struct hbicap_drvdata *drvdata = priv->drvdata;
+    struct scatterlist *sg;
+    dma_addr_t addr;
+    u32 left;
+    u32 len;
+    int status;
+    int i;
+
+    for_each_sgtable_dma_sg(sgt, sg, i) {
+        addr = sg_dma_address(sg);
+        left = sg_dma_len(sg);
+
+        while (left > 0) {
+            len = min(left, drvdata->max_transfer_size);
+
+            status = axi_cdma_write(drvdata, upper_32_bits(addr), lower_32_bits(addr),
+                drvdata->axi_data_phys_base_higher, drvdata->axi_data_phys_base_lower, len);
+            if (status) {
+                dev_err(&mgr->dev, "CDMA transmission was not successfull\n");
+                return status;
+            }
+
+            addr += len;
+            left -= len;
+        }
+    }
+
+    return 0;
+}
+
+
+/** function hbicap_write_sgt - write a scatter list table without bounce copy (mutex must be held)
+* @mgr:   fpga_manager struct
+* @sgt:   scatter list table containing FPGA image
+* @return 0 if success
+*
+* The pages of the image are mapped for the CDMA. Every segment must start on and contain
+* a whole number of 32 bit words. A single transfer is limited to max_transfer_size: the
+* AXI data window if the CDMA increments the destination address, the width of its bytes
+* to transfer register with key hole writes. If the CDMA includes the scatter gather
+* engine, the whole image is written with one descriptor chain.
+*/
+static int hbicap_write_sgt(struct fpga_manager *mgr, struct sg_table *sgt)
+{
+    struct hbicap_fpga_priv *priv = mgr->priv;
+    struct hbicap_drvdata *drvdata = priv->drvdata;
+    struct scatterlist *sg;
+    u64 size = 0;
+    int status;
+    int i;
+
+    // Map the pages of the image for the CDMA
+    status = dma_map_sgtable(drvdata->dma_dev, sgt, DMA_TO_DEVICE, 0);
+    if (status) {
+        dev_err(&mgr->dev, "Couldn't map the bitstream for the CDMA\n");
+        return status;
+    }
+
+    for_each_sgtable_dma_sg(sgt, sg, i) {
+        if (!IS_ALIGNED(sg_dma_address(sg) | sg_dma_len(sg), 4)) {
+            dev_err(&mgr->dev, "Bitstream segment %d is not 32 bit aligned\n", i);
+            status = -EINVAL;
+            goto error;
+        }
+        size += sg_dma_len(sg);
+    }
+
+    // Write the number of 32 bit words of the bitstream to the AXI HBICAP
+    axi_hbicap_set_size_register(drvdata, size >> 2);
+
+    if (drvdata->dma_chan)
+        status = hbicap_dmaengine_write_chunks(mgr, sgt);
+    else if (drvdata->cdma_sg_included)
+        status = hbicap_cdma_write_chain(mgr, sgt);
+    else
+        status = hbicap_cdma_write_simple(mgr, sgt);
+    if (status)
+        goto error;
+
+    // Wait until the write has finished. At most one transfer is still in the HBICAP.
+    status = hbicap_wait_for_done(drvdata, min_t(u64, size, drvdata->max_transfer_size));
+    if (status)
+        dev_err(&mgr->dev, "HBICAP did not finish the configuration\n");
+
+error:
+    dma_unmap_sgtable(drvdata->dma_dev, sgt, DMA_TO_DEVICE, 0);
+
+    return status;
+}
+
+
+/** function hbicap_write_buf_sgt - write a contiguous buffer through a scatter list table of its pages
+* @mgr:   fpga_manager struct
+* @buf:   contiguous buffer containing FPGA image (kernel or vmalloc memory)
+* @size:  size of buf
+* @return 0 if success
+*/
+static int hbicap_write_buf_sgt(struct fpga_manager *mgr, const char *buf, size_t size)
+{
+    struct page **pages;
+    struct sg_table sgt;
+    const char *p;
+    int nr_pages;
+    int index;
+    int status;
+
+    nr_pages = DIV_ROUND_UP((unsigned long) buf + size, PAGE_SIZE) - (unsigned long) buf / PAGE_SIZE;
+    pages = kmalloc_array(nr_pages, sizeof(struct page *), GFP_KERNEL);
+    if (!pages)
+        return -ENOMEM;
+
+    p = buf - offset_in_page(buf);
+    for (index = 0; index < nr_pages; index++) {
+        if (is_vmalloc_addr(p))
+            pages[index] = vmalloc_to_page(p);
+        else
+            pages[index] = virt_to_page(p);
+        p += PAGE_SIZE;
+    }
+
+    status = sg_alloc_table_from_pages(&sgt, pages, nr_pages, offset_in_page(buf), size, GFP_KERNEL);
+    kfree(pages);
+    if (status)
+        return status;
+
+    status = hbicap_write_sgt(mgr, &sgt);
+    sg_free_table(&sgt);
+
+    return status;
+}
+
+
+/** function hbicap_pio_write - write a bitstream from the CPU
+* @mgr:   fpga_manager struct
+* @buf:   contiguous buffer containing FPGA image
+* @size:  size of buf
+* @return 0 if success
+*
+* Used for small bitstreams and without CDMA. The bitstream is written to the
+* AXI data port directly from buf.
+*/
+static int hbicap_pio_write(struct fpga_manager *mgr, const char *buf, size_t size)
+{
+    struct hbicap_fpga_priv *priv = mgr->priv;
+    struct hbicap_drvdata *drvdata = priv->drvdata;
+    ktime_t deadline;
+    int status;
+
+    if (!IS_ALIGNED(size, 4)) {
+        dev_err(&mgr->dev, "Bitstream size %zu is not a multiple of 4\n", size);
+        return -EINVAL;
+    }
+
+    deadline = ktime_add_ns(ktime_get(), icap_wait_budget_ns(size, drvdata->icap_clock_hz,
+                                                             drvdata->icap_width));
+
+    // Write the number of 32 bit words of the bitstream to the AXI HBICAP
+    axi_hbicap_set_size_register(drvdata, size >> 2);
+
+    status = axi_hbicap_pio_write(drvdata, (const u32 *) buf, size >> 2, deadline);
+    if (status) {
+        dev_err(&mgr->dev, "HBICAP write FIFO did not accept the bitstream\n");
+        return status;
+    }
+
+    // Wait until the write has finished. At most the write FIFO is still in the HBICAP.
+    status = hbicap_wait_for_done(drvdata, min_t(size_t, size, drvdata->axi_data_size));
+    if (status)
+        dev_err(&mgr->dev, "HBICAP did not finish the configuration\n");
+
+    return status;
+}
+
+
+/** function hbicap_pio_write_sgt - write a scatter list table from the CPU
+* @mgr:   fpga_manager struct
+* @sgt:   scatter list table containing FPGA image
+* @size:  size of the image
+* @return 0 if success
+*/
+static int hbicap_pio_write_sgt(struct fpga_manager *mgr, struct sg_table *sgt, u64 size)
+{
+    struct hbicap_fpga_priv *priv = mgr->priv;
+    struct hbicap_drvdata *drvdata = priv->drvdata;
+    struct sg_mapping_iter miter;
+    ktime_t deadline;
+    int status = 0;
+
+    deadline = ktime_add_ns(ktime_get(), icap_wait_budget_ns(size, drvdata->icap_clock_hz,
+                                                             drvdata->icap_width));
+
+    // Write the number of 32 bit words of the bitstream to the AXI HBICAP
+    axi_hbicap_set_size_register(drvdata, size >> 2);
+
+    sg_miter_start(&miter, sgt->sgl, sgt->orig_nents, SG_MITER_FROM_SG);
+    while (sg_miter_next(&miter)) {
+        if (!IS_ALIGNED(miter.length, 4)) {
+            dev_err(&mgr->dev, "Bitstream segment is not 32 bit aligned\n");
+            status = -EINVAL;
+            break;
+        }
+
+        status = axi_hbicap_pio_write(drvdata, miter.addr, miter.length >> 2, deadline);
+        if (status) {
+            dev_err(&mgr->dev, "HBICAP write FIFO did not accept the bitstream\n");
+            break;
+        }
+    }
+    sg_miter_stop(&miter);
+    if (status)
+        return status;
+
+    // Wait until the write has finished. At most the write FIFO is still in the HBICAP.
+    status = hbicap_wait_for_done(drvdata, min_t(u64, size, drvdata->axi_data_size));
+    if (status)
+        dev_err(&mgr->dev, "HBICAP did not finish the configuration\n");
+
+    return status;
+}
+
+
+/** function hbicap_check_crc - parse a part of the bitstream and check its CRC packets
+* @mgr:   fpga_manager struct
+* @buf:   part of the bitstream, whole 32 bit words
+* @size:  size of buf
+* @return 0 if success
+*/
+static int hbicap_check_crc(struct fpga_manager *mgr, const void *buf, size_t size)
+{
+    struct hbicap_fpga_priv *priv = mgr->priv;
+    struct hbicap_drvdata *drvdata = priv->drvdata;
+
+    if (!drvdata->crc_check)
+        return 0;
+
+    if (icap_crc_update(&drvdata->crc, buf, size >> 2)) {
+        dev_err(&mgr->dev, "Configuration CRC of the bitstream does not match\n");
+        return -EBADMSG;
+    }
+
+    return 0;
+}
+
+
+/** function hbicap_check_crc_sgt - parse a scatter list table and check its CRC packets
+* @mgr:   fpga_manager struct
+* @sgt:   scatter list table containing FPGA image
+* @return 0 if success
+*
+* Used for the paths that transfer the image without the CPU touching it, so it is
+* checked as a whole before the first word is written.
+*/
+static int hbicap_check_crc_sgt(struct fpga_manager *mgr, struct sg_table *sgt)
+{
+    struct hbicap_fpga_priv *priv = mgr->priv;
+    struct sg_mapping_iter miter;
+    int status = 0;
+
+    if (!priv->drvdata->crc_check)
+        return 0;
+
+    sg_miter_start(&miter, sgt->sgl, sgt->orig_nents, SG_MITER_FROM_SG);
+    while (!status && sg_miter_next(&miter))
+        status = hbicap_check_crc(mgr, miter.addr, miter.length);
+    sg_miter_stop(&miter);
+
+    return status;
+}
+
+
+/** function hbicap_pio_write_staged - write a bitstream from the CPU through the stage buffer
+* @mgr:   fpga_manager struct
+* @src:   position in the bitstream
+* @size:  number of bytes to write
+* @return 0 if success
+*
+* Used for bitstreams written by the CPU that have to be converted into the order of
+* the ICAP. The words are converted and checked in pio_stage before they are written.
+*/
+static int hbicap_pio_write_staged(struct fpga_manager *mgr, struct hbicap_source *src, size_t size)
+{
+    struct hbicap_fpga_priv *priv = mgr->priv;
+    struct hbicap_drvdata *drvdata = priv->drvdata;
+    size_t left = size >> 2;
+    ktime_t deadline;
+    u32 words;
+    int status;
+
+    if (!IS_ALIGNED(size, 4)) {
+        dev_err(&mgr->dev, "Bitstream size %zu is not a multiple of 4\n", size);
+        return -EINVAL;
+    }
+
+    deadline = ktime_add_ns(ktime_get(), icap_wait_budget_ns(size, drvdata->icap_clock_hz,
+                                                             drvdata->icap_width));
+
+    // Write the number of 32 bit words of the bitstream to the AXI HBICAP
+    axi_hbicap_set_size_register(drvdata, size >> 2);
+
+    while (left > 0) {
+        words = min_t(size_t, left, HBICAP_PIO_STAGE_WORDS);
+
+        hbicap_source_read(src, drvdata->pio_stage, words << 2);
+        icap_swap_words(drvdata->pio_stage, words, drvdata->swap);
+
+        status = hbicap_check_crc(mgr, drvdata->pio_stage, words << 2);
+        if (status)
+            return status;
+
+        status = axi_hbicap_pio_write(drvdata, drvdata->pio_stage, words, deadline);
+        if (status) {
+            dev_err(&mgr->dev, "HBICAP write FIFO did not accept the bitstream\n");
+            return status;
+        }
+
+        left -= words;
+    }
+
+    // Wait until the write has finished. At most the write FIFO is still in the HBICAP.
+    status = hbicap_wait_for_done(drvdata, min_t(size_t, size, drvdata->axi_data_size));
+    if (status)
+        dev_err(&mgr->dev, "HBICAP did not finish the configuration\n");
+
+    return status;
+}
+
+
+/** function hbicap_write_staged - write a bitstream through the DDR buffers
+* @mgr:   fpga_manager struct
+* @src:   position in the bitstream
+* @size:  number of bytes to write
+* @return 0 if success
+*
+* The bitstream is written in chunks of ddr_size. The next chunk is copied into a free
+* DDR buffer while the previous ones are still transferred. The chunks are converted
+* into the order of the ICAP and checked in the DDR buffer, before they are transferred.
+*/
+static int hbicap_write_staged(struct fpga_manager *mgr, struct hbicap_source *src, size_t size)
+{
+    struct hbicap_fpga_priv *priv = mgr->priv;
+    struct hbicap_drvdata *drvdata = priv->drvdata;
+    ssize_t written = 0;
+    ssize_t left = size;
+    ssize_t len;
+    int status;
+    int buffer = 0;
+    ktime_t copy_start;
+    u64 copy_time;
+
+    // Borrow the DDR buffers for this load
+    status = hbicap_ddr_buffers_get(drvdata);
+    if (status) {
+        dev_err(&mgr->dev, "Couldn't get DDR buffers from the shared pool\n");
+        return status;
+    }
+
+    // Write the number of 32 bit words of the bitstream to the AXI HBICAP
+    axi_hbicap_set_size_register(drvdata, size >> 2);
+
+    while (left > 0) {
+        len = ((left < drvdata->ddr_size) ? left : drvdata->ddr_size);
+
+        // Wait until the transfer of the buffer is finished
+        status = hbicap_buffer_wait(drvdata, buffer);
+        if (status) {
+            dev_err(&mgr->dev, "CDMA transmission was not successfull\n");
+            goto error_abort;
+        }
+
+        // Copy from the bitstream to DDR
+        copy_start = ktime_get();
+        hbicap_copy_to_buffer(drvdata, buffer, src, len);
+        copy_time = ktime_to_ns(ktime_sub(ktime_get(), copy_start));
+
+        // The copy overlapped a transfer that is still running when it ends
+        drvdata->copy_time_ns += copy_time;
+        if (hbicap_buffers_running(drvdata))
+            drvdata->copy_time_hidden_ns += copy_time;
+
+        // Check the chunk before any of it is written
+        status = hbicap_check_crc(mgr, drvdata->ddr_virt_base_addr[buffer], len);
+        if (status)
+            goto error_abort;
+
+        // Write the data to the AXI HBICAP via the AXI CDMA
+        status = hbicap_buffer_start(drvdata, buffer, len);
+        if(status) {
+            dev_err(&mgr->dev, "CDMA transmission was not successfull\n");
+            goto error_abort;
+        }
+
+        // update written and left counter
+        written += len;
+        left -= len;
+        buffer = (buffer + 1) % HBICAP_DDR_BUFFERS;
+    }
+
+    // Wait for the last chunks
+    for (buffer = 0; buffer < HBICAP_DDR_BUFFERS; buffer++) {
+        status = hbicap_buffer_wait(drvdata, buffer);
+        if (status) {
+            dev_err(&mgr->dev, "CDMA transmission was not successfull\n");
+            goto error_abort;
+        }
+    }
+
+    // Wait until the write has finished. At most one DDR buffer is still in the HBICAP.
+    status = hbicap_wait_for_done(drvdata, drvdata->ddr_size);
+    if (status) {
+        dev_err(&mgr->dev, "HBICAP did not finish the configuration\n");
+        return status;
+    }
+
+    //check if the whole bitstream was written
+    return (size - written);
+
+ error_abort:
+    hbicap_buffers_abort(drvdata);
+    hbicap_ddr_buffers_put(drvdata);
+
+    return status;
+}
+
+
+/** function hbicap_unpack_write - decompress a part of a compressed bitstream and write it
+* @mgr:     fpga_manager struct
+* @in:      part of the compressed bitstream
+* @in_len:  size of in
+* @return 0 if success
+*
+* The bitstream is decompressed straight into the DDR buffers, or into pio_stage if it is
+* written by the CPU, and converted and checked there. The whole bitstream is one transaction
+* that is started by the first part. The transfers of the DDR buffers may still be running
+* afterwards, they are waited for by hbicap_unpack_finish.
+*/
+static int hbicap_unpack_write(struct fpga_manager *mgr, const u8 *in, size_t in_len)
+{
+    struct hbicap_fpga_priv *priv = mgr->priv;
+    struct hbicap_drvdata *drvdata = priv->drvdata;
+    struct icap_unzstd *z = &drvdata->unzstd;
+    ktime_t deadline;
+    size_t cap;
+    size_t len;
+    size_t n;
+    ssize_t ret;
+    u32 words;
+    u8 *dst;
+    int buffer;
+    int status;
+
+    // Drop the .bit header and the words before the sync word
+    while (drvdata->skip_bytes) {
+        ret = icap_unzstd_read(z, &in, &in_len, drvdata->pio_stage,
+                               min_t(size_t, drvdata->skip_bytes, sizeof(drvdata->pio_stage)));
+        if (ret <= 0)
+            goto out;
+        drvdata->skip_bytes -= ret;
+    }
+
+    if (!drvdata->unpack_words)
+        return 0;
+
+    if (!drvdata->unpack_started) {
+        drvdata->unpack_pio = drvdata->pio_only ||
+                              (drvdata->unpack_words << 2) <= drvdata->pio_threshold;
+
+        // Borrow the DDR buffers for this load
+        if (!drvdata->unpack_pio) {
+            status = hbicap_ddr_buffers_get(drvdata);
+            if (status) {
+                dev_err(&mgr->dev, "Couldn't get DDR buffers from the shared pool\n");
+                return status;
+            }
+        }
+
+        // Write the number of 32 bit words of the bitstream to the AXI HBICAP
+        axi_hbicap_set_size_register(drvdata, drvdata->unpack_words);
+        drvdata->unpack_started = true;
+    }
+
+    while (drvdata->unpack_words) {
+        buffer = drvdata->unpack_buffer;
+        if (drvdata->unpack_pio) {
+            dst = (u8 *) drvdata->pio_stage;
+            cap = sizeof(drvdata->pio_stage);
+        }
+        else {
+            // Wait until the transfer of the buffer is finished
+            status = hbicap_buffer_wait(drvdata, buffer);
+            if (status) {
+                dev_err(&mgr->dev, "CDMA transmission was not successfull\n");
+                return status;
+            }
+
+            dst = (u8 *) drvdata->ddr_virt_base_addr[buffer];
+            cap = drvdata->ddr_size;
+        }
+        len = min_t(u64, cap, drvdata->unpack_words << 2);
+
+        if (!drvdata->unpack_pio && (drvdata->ddr_cached || drvdata->ddr_pooled))
+            dma_sync_single_for_cpu(drvdata->dma_dev, drvdata->ddr_phys_base_addr[buffer],
+                                    len, DMA_TO_DEVICE);
+
+        // Complete the word started by the last part
+        n = drvdata->write_buffer_in_use;
+        memcpy(dst, drvdata->write_buffer, n);
+        ret = icap_unzstd_read(z, &in, &in_len, dst + n, len - n);
+        if (ret < 0)
+            goto out;
+        n += ret;
+
+        // Keep the bytes of an incomplete last word for the next part
+        words = n >> 2;
+        drvdata->write_buffer_in_use = n & 3;
+        memcpy(drvdata->write_buffer, dst + (words << 2), n & 3);
+
+        icap_swap_words((u32 *) dst, words, drvdata->swap);
+        status = hbicap_check_crc(mgr, dst, words << 2);
+        if (status)
+            return status;
+
+        if (drvdata->unpack_pio) {
+            deadline = ktime_add_ns(ktime_get(), icap_wait_budget_ns(words << 2,
+                                    drvdata->icap_clock_hz, drvdata->icap_width));
+            status = axi_hbicap_pio_write(drvdata, (const u32 *) dst, words, deadline);
+            if (status) {
+                dev_err(&mgr->dev, "HBICAP write FIFO did not accept the bitstream\n");
+                return status;
+            }
+        }
+        else {
+            if (drvdata->ddr_cached || drvdata->ddr_pooled)
+                dma_sync_single_for_device(drvdata->dma_dev, drvdata->ddr_phys_base_addr[buffer],
+                                           len, DMA_TO_DEVICE);
+
+            // Write the data to the AXI HBICAP via the AXI CDMA
+            if (words) {
+                status = hbicap_buffer_start(drvdata, buffer, words << 2);
+                if (status) {
+                    dev_err(&mgr->dev, "CDMA transmission was not successfull\n");
+                    return status;
+                }
+                drvdata->unpack_buffer = (buffer + 1) % HBICAP_DDR_BUFFERS;
+            }
+        }
+
+        drvdata->unpack_words -= words;
+
+        // The part is used up
+        if (n < len)
+            break;
+    }
+
+    return 0;
+
+ out:
+    if (ret < 0)
+        dev_err(&mgr->dev, "Compressed bitstream is corrupt\n");
+    return (ret < 0) ? ret : 0;
+}
+
+
+/** function hbicap_unpack_finish - wait for the transfers of a compressed bitstream
+* @mgr:   fpga_manager struct
+* @return 0 if success
+*
+* Waits for the DDR buffers. After the last word of the bitstream, it also waits until
+* the HBICAP has finished the transaction.
+*/
+static int hbicap_unpack_finish(struct fpga_manager *mgr)
+{
+    struct hbicap_fpga_priv *priv = mgr->priv;
+    struct hbicap_drvdata *drvdata = priv->drvdata;
+    int buffer;
+    int status;
+
+    if (!drvdata->unpack_started)
+        return 0;
+
+    // Wait for the last chunks
+    if (!drvdata->unpack_pio) {
+        for (buffer = 0; buffer < HBICAP_DDR_BUFFERS; buffer++) {
+            status = hbicap_buffer_wait(drvdata, buffer);
+            if (status) {
+                dev_err(&mgr->dev, "CDMA transmission was not successfull\n");
+                return status;
+            }
+        }
+        drvdata->unpack_buffer = 0;
+    }
+
+    if (drvdata->unpack_words)
+        return 0;
+
+    // Wait until the write has finished
+    drvdata->unpack_started = false;
+    status = hbicap_wait_for_done(drvdata, drvdata->unpack_pio ? drvdata->axi_data_size :
+                                                                 drvdata->ddr_size);
+    if (status)
+        dev_err(&mgr->dev, "HBICAP did not finish the configuration\n");
+
+    return status;
+}
+
+
+/** function hbicap_load_end - end a load that failed before write_complete
+* @drvdata:  hbicap_drvdata struct
+*
+* Used where the mutex could not be taken, so readbacks are not refused after the load.
+*/
+static void hbicap_load_end(struct hbicap_drvdata *drvdata)
+{
+    mutex_lock(&drvdata->sem);
+    drvdata->load_active = false;
+    mutex_unlock(&drvdata->sem);
+}
+
+
+/** function hbicap_fpga_ops_write - write count bytes of configuration data to the FPGA
+* @mgr:   fpga_manager struct
+* @buf:   contiguous buffer containing FPGA image
+* @size:  size of buf
+* @return 0 if success
+*
+* The bitstream can be written in parts of any size, every part is a transaction of
+* its whole words. The header found by write_init is dropped. Bitstreams that are not
+* in the order of the ICAP and parts that start with a word of the last part are
+* staged, the CPU converts them while it copies them.
+*/
+static int hbicap_fpga_ops_write(struct fpga_manager *mgr,
+                 const char *buf, size_t size)
+{
+    struct hbicap_fpga_priv *priv;
+    struct hbicap_drvdata *drvdata;
+    struct hbicap_source src = { };
+    size_t total;
+    size_t skip;
+    size_t tail;
+    bool direct;
+    int status;
+
+    mgr->state = FPGA_MGR_STATE_WRITE;
+
+    priv = mgr->priv;
+    drvdata = priv->drvdata;
+
+    status = mutex_lock_interruptible(&drvdata->sem);
+    if (status) {
+        hbicap_load_end(drvdata);
+        mgr->state = FPGA_MGR_STATE_WRITE_ERR;
+        return status;
+    }
+
+    if (drvdata->unzstd.stream) {
+        status = hbicap_unpack_write(mgr, (const u8 *) buf, size);
+        if (!status)
+            status = hbicap_unpack_finish(mgr);
+        if (status) {
+            hbicap_buffers_abort(drvdata);
+            hbicap_ddr_buffers_put(drvdata);
+        }
+        goto error;
+    }
+
+    // Drop the .bit header and the words before the sync word
+    skip = min(drvdata->skip_bytes, size);
+    drvdata->skip_bytes -= skip;
+    buf  += skip;
+    size -= skip;
+
+    // The bitstream may be passed in parts of any size. The word started by the last
+    // part is completed first, the bytes of an incomplete last word are kept for the next.
+    total = drvdata->write_buffer_in_use + size;
+    if (total < 4) {
+        memcpy(drvdata->write_buffer + drvdata->write_buffer_in_use, buf, size);
+        drvdata->write_buffer_in_use = total;
+        goto error;
+    }
+
+    src.head_len = drvdata->write_buffer_in_use;
+    memcpy(src.head + 4 - src.head_len, drvdata->write_buffer, src.head_len);
+    src.buf = buf;
+
+    tail = total & 3;
+    memcpy(drvdata->write_buffer, buf + size - tail, tail);
+    drvdata->write_buffer_in_use = tail;
+    size  -= tail;
+    total -= tail;
+
+    direct = (drvdata->swap == ICAP_SWAP_NONE && !src.head_len);
+
+    // Small bitstreams and systems without CDMA are written by the CPU. The direct
+    // paths write from buf, so the CRC is checked before the first word.
+    if (direct && (drvdata->pio_only || total <= drvdata->pio_threshold ||
+        (drvdata->cdma_sg_included && IS_ALIGNED((unsigned long) buf, 4)))) {
+        status = hbicap_check_crc(mgr, buf, size);
+        if (status)
+            goto error;
+    }
+
+    if (drvdata->pio_only || total <= drvdata->pio_threshold) {
+        if (direct)
+            status = hbicap_pio_write(mgr, buf, size);
+        else
+            status = hbicap_pio_write_staged(mgr, &src, total);
+        goto error;
+    }
+
+    // With the scatter gather engine the whole part is written with one
+    // descriptor chain directly from buf
+    if (direct && drvdata->cdma_sg_included && IS_ALIGNED((unsigned long) buf, 4)) {
+        status = hbicap_write_buf_sgt(mgr, buf, size);
+        goto error;
+    }
+
+    status = hbicap_write_staged(mgr, &src, total);
+
+ error:
+    if (status) {
+        drvdata->load_active = false;
+        mgr->state = FPGA_MGR_STATE_WRITE_ERR;
+    }
+    mutex_unlock(&drvdata->sem);
+
+    return status;
+}
+
+
+/** function hbicap_fpga_ops_write_sg - write the scatter list table of configuration data to the FPGA
+* @mgr:   fpga_manager struct
+* @sgt:   scatter list table containing FPGA image
+* @return 0 if success
+*
+* The pages of the image are transferred to the AXI HBICAP directly, without copying
+* them into the DDR buffers first. Images with a header or in another order than the
+* one of the ICAP are staged and converted by the CPU.
+*/
+static int hbicap_fpga_ops_write_sg(struct fpga_manager *mgr, struct sg_table *sgt)
+{
+    struct hbicap_fpga_priv *priv;
+    struct hbicap_drvdata *drvdata;
+    struct hbicap_source src = { };
+    struct scatterlist *sg;
+    u64 size = 0;
+    int status;
+    int i;
+
+    mgr->state = FPGA_MGR_STATE_WRITE;
+
+    priv = mgr->priv;
+    drvdata = priv->drvdata;
+
+    status = mutex_lock_interruptible(&drvdata->sem);
+    if (status) {
+        hbicap_load_end(drvdata);
+        mgr->state = FPGA_MGR_STATE_WRITE_ERR;
+        return status;
+    }
+
+    for_each_sgtable_sg(sgt, sg, i)
+        size += sg->length;
+
+    if (drvdata->unzstd.stream) {
+        sg_miter_start(&src.miter, sgt->sgl, sgt->orig_nents, SG_MITER_FROM_SG);
+        while (!status && sg_miter_next(&src.miter))
+            status = hbicap_unpack_write(mgr, src.miter.addr, src.miter.length);
+        sg_miter_stop(&src.miter);
+
+        if (!status)
+            status = hbicap_unpack_finish(mgr);
+        if (status) {
+            hbicap_buffers_abort(drvdata);
+            hbicap_ddr_buffers_put(drvdata);
+        }
+        goto error;
+    }
+
+    if (drvdata->skip_bytes || drvdata->swap != ICAP_SWAP_NONE) {
+        // Drop the .bit header and the words before the sync word
+        size -= min_t(u64, drvdata->skip_bytes, size);
+
+        // The table holds the whole bitstream, there is no later part to complete a word
+        if (size & 3) {
+            dev_err(&mgr->dev, "Bitstream ends with an incomplete word\n");
+            status = -EINVAL;
+            goto error;
+        }
+
+        sg_miter_start(&src.miter, sgt->sgl, sgt->orig_nents, SG_MITER_FROM_SG);
+        hbicap_source_read(&src, NULL, drvdata->skip_bytes);
+        drvdata->skip_bytes = 0;
+
+        if (drvdata->pio_only || size <= drvdata->pio_threshold)
+            status = hbicap_pio_write_staged(mgr, &src, size);
+        else
+            status = hbicap_write_staged(mgr, &src, size);
+        sg_miter_stop(&src.miter);
+        goto error;
+    }
+
+    status = hbicap_check_crc_sgt(mgr, sgt);
+    if (status)
+        goto error;
+
+    // Small bitstreams and systems without CDMA are written by the CPU
+    if (drvdata->pio_only || size <= drvdata->pio_threshold)
+        status = hbicap_pio_write_sgt(mgr, sgt, size);
+    else
+        status = hbicap_write_sgt(mgr, sgt);
+
+ error:
+    if (status) {
+        drvdata->load_active = false;
+        mgr->state = FPGA_MGR_STATE_WRITE_ERR;
+    }
+    mutex_unlock(&drvdata->sem);
+
+    return status;
+}
+
+
+/** function hbicap_fpga_ops_write_complete - set FPGA to operating state after writing is done
+* @mgr:   fpga_manager struct
+* @info:  fpga_image_info struct
+* @return 0 if success
+*/
+int hbicap_fpga_ops_write_complete(struct fpga_manager *mgr, struct fpga_image_info *info)
+{
+    struct hbicap_fpga_priv *priv = mgr->priv;
+    struct hbicap_drvdata *drvdata = priv->drvdata;
+    const char *error;
+    u32 stat;
+    int status = 0;
+
+    // Return the DDR buffers for the next load of any device
+    mutex_lock(&drvdata->sem);
+    drvdata->load_active = false;
+    hbicap_ddr_buffers_put(drvdata);
+
+    // The decoder is not needed anymore, a missing end is an error
+    if (drvdata->unzstd.stream && drvdata->unpack_words) {
+        icap_unzstd_free(&drvdata->unzstd);
+        mutex_unlock(&drvdata->sem);
+        dev_err(&mgr->dev, "Compressed bitstream ends early\n");
+        mgr->state = FPGA_MGR_STATE_WRITE_COMPLETE_ERR;
+        return -EINVAL;
+    }
+    icap_unzstd_free(&drvdata->unzstd);
+
+    // Bytes of an incomplete last word never reached the HBICAP
+    if (drvdata->write_buffer_in_use) {
+        mutex_unlock(&drvdata->sem);
+        dev_err(&mgr->dev, "Bitstream ends with an incomplete word\n");
+        mgr->state = FPGA_MGR_STATE_WRITE_COMPLETE_ERR;
+        return -EINVAL;
+    }
+
+    // A few words tell whether the ICAP accepted the bitstream
+    if (verify_load)
+        status = hbicap_get_configuration_register(drvdata, drvdata->config_regs->STAT, &stat);
+    mutex_unlock(&drvdata->sem);
+
+    if (status) {
+        dev_err(&mgr->dev, "Couldn't read the STAT register\n");
+        mgr->state = FPGA_MGR_STATE_WRITE_COMPLETE_ERR;
+        return status;
+    }
+    else if (verify_load) {
+        error = icap_stat_error(stat);
+        if (error) {
+            dev_err(&mgr->dev, "ICAP reports a %s (STAT = %08x)\n", error, stat);
+            mgr->state = FPGA_MGR_STATE_WRITE_COMPLETE_ERR;
+            return -EIO;
+        }
+        dev_dbg(&mgr->dev, "STAT = %x\n", stat);
+    }
+
+    // mgr->state = FPGA_MGR_STATE_WRITE_COMPLETE;
+	mgr->state = FPGA_MGR_STATE_OPERATING;
+    return 0;
+}
+
+
+/** function copy_time_ns_show - sysfs attribute with the time spent copying into the DDR buffers
+* @dev:   device struct of the fpga manager
+* @attr:  device_attribute struct
+* @buf:   output buffer
+* @return number of bytes written to buf
+*/
+static ssize_t copy_time_ns_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct fpga_manager *mgr = to_fpga_manager(dev);
+    struct hbicap_fpga_priv *priv = mgr->priv;
+
+    return sprintf(buf, "%llu\n", priv->drvdata->copy_time_ns);
+}
+static DEVICE_ATTR_RO(copy_time_ns);
+
+/** function copy_time_hidden_ns_show - sysfs attribute with the copy time that overlapped a CDMA transfer
+* @dev:   device struct of the fpga manager
+* @attr:  device_attribute struct
+* @buf:   output buffer
+* @return number of bytes written to buf
+*
+* A copy counts as hidden if a transfer was still running when the copy ended. With the
+* polled CDMA registers, a transfer counts as running until it is waited for, so the value
+* is an upper bound there.
+*/
+static ssize_t copy_time_hidden_ns_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct fpga_manager *mgr = to_fpga_manager(dev);
+    struct hbicap_fpga_priv *priv = mgr->priv;
+
+    return sprintf(buf, "%llu\n", priv->drvdata->copy_time_hidden_ns);
+}
+static DEVICE_ATTR_RO(copy_time_hidden_ns);
+
+/** function reg_reads_show - sysfs attribute with the number of register reads during the last load
+* @dev:   device struct of the fpga manager
+* @attr:  device_attribute struct
+* @buf:   output buffer
+* @return number of bytes written to buf
+*
+* Each read is a round trip over the chip-to-chip link in multi-board setups.
+*/
+static ssize_t reg_reads_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct fpga_manager *mgr = to_fpga_manager(dev);
+    struct hbicap_fpga_priv *priv = mgr->priv;
+
+    return sprintf(buf, "%u\n", priv->drvdata->lite_regs.reads + priv->drvdata->cdma_regs.reads);
+}
+static DEVICE_ATTR_RO(reg_reads);
+
+/** function reg_writes_show - sysfs attribute with the number of register writes during the last load
+* @dev:   device struct of the fpga manager
+* @attr:  device_attribute struct
+* @buf:   output buffer
+* @return number of bytes written to buf
+*/
+static ssize_t reg_writes_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct fpga_manager *mgr = to_fpga_manager(dev);
+    struct hbicap_fpga_priv *priv = mgr->priv;
+
+    return sprintf(buf, "%u\n", priv->drvdata->lite_regs.writes + priv->drvdata->cdma_regs.writes);
+}
+static DEVICE_ATTR_RO(reg_writes);
+
+static struct attribute *hbicap_fpga_attrs[] = {
+    &dev_attr_copy_time_ns.attr,
+    &dev_attr_copy_time_hidden_ns.attr,
+    &dev_attr_reg_reads.attr,
+    &dev_attr_reg_writes.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(hbicap_fpga);
+
+
+/**
+* struct hbicap_fpga_ops - ops for low level fpga manager drivers
+* @initial_header_size: bytes of the bitstream passed to write_init
+* @write_init:     prepare the FPGA to receive configuration data
+* @write:          write count bytes of configuration data to the FPGA
+* @write_sg:       write the scatter list table of configuration data to the FPGA
+* @write_complete: set FPGA to operating state after writing is done
+* @state:          returns an enum value of the FPGA's state
+* @groups:         sysfs attributes with the statistics of the last load
+*/
+static const struct fpga_manager_ops hbicap_fpga_ops = {
+    .initial_header_size = ICAP_BITSTREAM_HEADER_SIZE,
+    .write_init     = hbicap_fpga_ops_write_init,
+    .write          = hbicap_fpga_ops_write,
+    .write_sg       = hbicap_fpga_ops_write_sg,
+    .write_complete = hbicap_fpga_ops_write_complete,
+    .state          = hbicap_fpga_ops_state,
+    .groups         = hbicap_fpga_groups,
+};
+
+
+/** function hbicap_unzstd_release - free the decoder of an unfinished load
+* @data:  hbicap_drvdata struct
+*/
+static void hbicap_unzstd_release(void *data)
+{
+    struct hbicap_drvdata *drvdata = data;
+
+    icap_unzstd_free(&drvdata->unzstd);
+}
+
+
+/** function hbicap_fpga_probe - probe function
+* @pdev:  platform_device struct
+* @return 0 if success
+*/
+static int hbicap_fpga_probe(struct platform_device *pdev)
+{
+    struct device *dev;
+    struct hbicap_fpga_priv *priv;
+    struct fpga_manager *mgr;
+    int ret;
+
+    dev = &pdev->dev;
+
+    priv = devm_kzalloc(dev, sizeof(*priv), GFP_KERNEL);
+    if (!priv)
+        return -ENOMEM;
+
+    priv->dev = dev;
+
+    // Only support partial reconfiguration
+    priv->feature_list = FPGA_MGR_PARTIAL_RECONFIG;
+
+    // HBICAP Setup
+    ret = hbicap_setup(&pdev->dev, priv);
+    if (ret) {
+        dev_err(&pdev->dev, "Error in hbicap_setup\n");
+        return ret;
+    }
+
+    mgr = devm_fpga_mgr_create(dev, "Xilinx HBICAP FPGA Manager",
+                    &hbicap_fpga_ops, priv);
+
+    if (IS_ERR(mgr))
+        return PTR_ERR(mgr);
+
+    mgr->state = FPGA_MGR_STATE_OPERATING;
+
+    ret = hbicap_readback_register(dev, priv->drvdata);
+    if (ret)
+        return ret;
+
+    ret = devm_add_action_or_reset(dev, hbicap_unzstd_release, priv->drvdata);
+    if (ret)
+        return ret;
+
+    return devm_fpga_mgr_register(dev, mgr);
+}
+
+
+#ifdef CONFIG_OF
+/* Match table for device tree binding */
+static const struct of_device_id hbicap_fpga_of_match[] = {
+    { .compatible = "xlnx,hbicap-fpga", },
+    {},
+};
+MODULE_DEVICE_TABLE(of, hbicap_fpga_of_match);
+#endif
+
+static struct platform_driver hbicap_fpga_driver = {
+    .probe = hbicap_fpga_probe,
+    .driver = {
+        .name = DRIVER_NAME,
+        .of_match_table = of_match_ptr(hbicap_fpga_of_match),
+    },
+};
+
+
+static int __init hbicap_fpga_init(void)
+{
+    int ret;
+
+    hbicap_readback_debugfs_init();
+
+    ret = platform_driver_register(&hbicap_fpga_driver);
+    if (ret)
+        hbicap_readback_debugfs_exit();
+
+    return ret;
+}
+module_init(hbicap_fpga_init);
+
+static void __exit hbicap_fpga_exit(void)
+{
+    platform_driver_unregister(&hbicap_fpga_driver);
+    hbicap_readback_debugfs_exit();
+    hbicap_pool_destroy();
+}
+module_exit(hbicap_fpga_exit);
 
 MODULE_AUTHOR("KIT-IPE, Hendrik Krause <Hendrik.Krause@kit.edu>");
 MODULE_DESCRIPTION("Xilinx HBICAP FPGA Manager");
@@ -34,8 +34,32 @@
 #include <linux/types.h>
 #include <linux/cdev.h>
 #include <linux/platform_device.h>
+#include <linux/completion.h>
+#include <linux/dmaengine.h>
 
 #include <linux/io.h>
+#include "icap-regs.h"
+#include "icap-packets.h"
+#include "icap-crc.h"
+#include "icap-bitstream.h"
+#include "icap-unzstd.h"
+
+// Number of DDR staging buffers. While the CDMA transfers one buffer the next
+// chunk of the bitstream is copied into another one.
+#define HBICAP_DDR_BUFFERS 2
+
+// Words of a bitstream that is converted by the CPU before it is written from the CPU
+#define HBICAP_PIO_STAGE_WORDS 256
+
+struct hbicap_pool_chunk;
+
+// Completion of a transfer submitted to the DMA engine channel
+struct hbicap_dma_slot {
+    struct completion done;                     /* signaled by the DMA engine callback */
+    enum dmaengine_tx_result result;            /* result of the transfer */
+    bool pending;                               /* transfer submitted but not waited for */
+    u32 size;                                   /* bytes of the transfer, sets the time budget of the wait */
+};
 
 // HBICAP driver data structure
 struct hbicap_drvdata {
@@ -43,45 +67,70 @@ struct hbicap_drvdata {
     resource_size_t axi_lite_phys_end_addr;     /* phys. address of the AXI Lite control registers */
     resource_size_t axi_lite_size;              /* AXI Lite control register size*/
     void __iomem *axi_lite_virt_base_addr;      /* virt. address of the AXI Lite control registers */
+    struct icap_regs lite_regs;                 /* access to the AXI Lite control registers */
 
     u32 axi_data_phys_base_lower;               /* phys. address of the AXI data registers (lower 32 bit)*/
     u32 axi_data_phys_base_higher;              /* phys. address of the AXI data registers (higher 32 bit)*/
     u32 axi_data_size;                          /* AXI data register size*/
+    void __iomem *axi_data_virt_base_addr;      /* virt. address of the AXI data registers, device memory */
+    u32 pio_threshold;                          /* bitstreams up to this size are written by the CPU */
+    bool pio_only;                              /* no CDMA, all bitstreams are written by the CPU */
+    u32 pio_stage[HBICAP_PIO_STAGE_WORDS];      /* converted words of a bitstream written by the CPU */
+
+    u32 *ddr_virt_base_addr[HBICAP_DDR_BUFFERS];       /* virt. addresses of the DDR buffers */
+    dma_addr_t ddr_phys_base_addr[HBICAP_DDR_BUFFERS]; /* phys. addresses of the DDR buffers */
+    u32 ddr_size;                               /* size of each DDR buffer */
+    u32 max_transfer_size;                      /* maximum size of a single CDMA transfer */
+    bool ddr_reserved_mem;                      /* DDR buffers come from the memory-region of the device */
+    bool ddr_cached;                            /* DDR buffers are cached and synced before each transfer */
+    bool ddr_pooled;                            /* DDR buffers are borrowed from the shared pool for each load */
+    struct hbicap_pool_chunk *ddr_chunks[HBICAP_DDR_BUFFERS]; /* borrowed chunks, NULL if not borrowed */
 
-    u32 *ddr_virt_base_addr;                    /* virt. address of the DDR buffer */
-    u32 *ddr_phys_base_addr;                    /* phys. address of the DDR buffer */
-    u32 ddr_size;                               /* DDR buffer size */
+    u64 copy_time_ns;                           /* time spent copying into the DDR buffers during the last load */
+    u64 copy_time_hidden_ns;                    /* part of copy_time_ns that overlapped a running CDMA transfer */
 
     void __iomem *cdma_virt_base_addr;          /* virt. address of the AXI Lite CDMA control registers */
+    struct icap_regs cdma_regs;                 /* access to the AXI Lite CDMA control registers */
+    bool cdma_sg_included;                      /* the CDMA was built with the scatter gather engine */
+    bool cdma_key_hole_write;                   /* the CDMA writes every transfer to the same address */
+    int cdma_irq;                               /* CDMA interrupt, polling is used if not wired */
+    u32 cdma_irq_status;                        /* CDMA status register read by the interrupt handler */
+    struct completion cdma_done;                /* CDMA transfer or descriptor chain done */
+    ktime_t cdma_deadline;                      /* end of the time budget of the running CDMA transfer */
 
-    const struct config_registers *config_regs; /* Config register struct. Currently not used.*/
-    struct mutex sem;                           /* Mutex */
-};
+    struct dma_chan *dma_chan;                  /* DMA engine channel, the CDMA registers are used directly if NULL */
+    struct device *dma_dev;                     /* device used for DMA mappings and allocations */
+    dma_addr_t dma_data_addr;                   /* DMA address of the AXI data registers */
+    struct hbicap_dma_slot dma_slots[HBICAP_DDR_BUFFERS]; /* one per DDR buffer */
+
+    u32 icap_clock_hz;                          /* ICAP clock, used for the time budget of the waits */
+    u32 icap_width;                             /* ICAP width in bits, used for the time budget of the waits */
+
+    int hbicap_irq;                             /* HBICAP interrupt, polling is used if not wired */
+    struct completion hbicap_done;              /* HBICAP write FIFO empty */
+
+    struct icap_crc crc;                        /* CRC check of the current bitstream */
+    bool crc_check;                             /* the CRC of the current bitstream is checked */
+    size_t skip_bytes;                          /* bytes in front of the sync word that are not written */
+    enum icap_swap swap;                        /* conversion of the words of the current bitstream */
+    u8 write_buffer[4];                         /* bytes of an incomplete word, completed by the next write */
+    u32 write_buffer_in_use;                    /* bytes in write_buffer, always in [0,3] */
 
-// Config register structure
-struct config_registers {
-    u32 CRC;
-    u32 FAR;
-    u32 FDRI;
-    u32 FDRO;
-    u32 CMD;
-    u32 CTL;
-    u32 MASK;
-    u32 STAT;
-    u32 LOUT;
-    u32 COR;
-    u32 MFWR;
-    u32 FLR;
-    u32 KEY;
-    u32 CBC;
-    u32 IDCODE;
-    u32 AXSS;
-    u32 C0R_1;
-    u32 CSOB;
-    u32 WBSTAR;
-    u32 TIMER;
-    u32 BOOTSTS;
-    u32 CTL_1;
+    struct icap_unzstd unzstd;                  /* decoder of a compressed bitstream */
+    u64 unpack_words;                           /* words of the compressed bitstream not written yet */
+    bool unpack_started;                        /* the size register is set for the compressed bitstream */
+    bool unpack_pio;                            /* the compressed bitstream is written by the CPU */
+    int unpack_buffer;                          /* next DDR buffer of the compressed bitstream */
+
+    u32 readback_far;                           /* frame address of the next readback */
+    u32 readback_words;                         /* number of words of the next readback */
+    bool readback_active;                       /* a readback owns the HBICAP */
+    bool load_active;                           /* a load owns the HBICAP from write_init to write_complete */
+    u32 *query_buf;                             /* CDMA target of configuration register queries */
+    dma_addr_t query_phys;                      /* DMA address of query_buf */
+
+    const struct config_registers *config_regs; /* Config register struct. Used for the readback packets.*/
+    struct mutex sem;                           /* Mutex */
 };
 
 #endif
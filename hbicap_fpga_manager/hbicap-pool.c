@@ -0,0 +1,88 @@
+#include "hbicap-pool.h"
+
+#include <linux/gfp.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+
+static LIST_HEAD(hbicap_pool_free);     /* chunks that are not borrowed */
+static unsigned int hbicap_pool_nr_free; /* number of chunks in hbicap_pool_free */
+static DEFINE_MUTEX(hbicap_pool_lock);  /* protects hbicap_pool_free and hbicap_pool_nr_free */
+
+/**
+ * hbicap_pool_get - Borrow a chunk from the pool
+ * @size:  minimum size of the chunk in bytes
+ * @dma32: the chunk must be in the lower 4G of the DDR
+ *
+ * A new chunk is allocated if no free chunk fits. Returns NULL if that fails.
+ **/
+struct hbicap_pool_chunk *hbicap_pool_get(u32 size, bool dma32)
+{
+    struct hbicap_pool_chunk *chunk;
+
+    mutex_lock(&hbicap_pool_lock);
+    list_for_each_entry(chunk, &hbicap_pool_free, list) {
+        if (chunk->size >= size && (chunk->dma32 || !dma32)) {
+            list_del(&chunk->list);
+            hbicap_pool_nr_free--;
+            mutex_unlock(&hbicap_pool_lock);
+            return chunk;
+        }
+    }
+    mutex_unlock(&hbicap_pool_lock);
+
+    // No free chunk fits, so the pool grows
+    chunk = kzalloc(sizeof(*chunk), GFP_KERNEL);
+    if (!chunk)
+        return NULL;
+
+    chunk->virt = alloc_pages_exact(size, GFP_KERNEL | __GFP_NOWARN | (dma32 ? GFP_DMA32 : 0));
+    if (!chunk->virt) {
+        kfree(chunk);
+        return NULL;
+    }
+    chunk->size  = size;
+    chunk->dma32 = dma32;
+
+    return chunk;
+}
+
+/**
+ * hbicap_pool_put - Return a chunk to the pool
+ * @chunk: the chunk borrowed with hbicap_pool_get
+ *
+ * The chunk is freed if HBICAP_POOL_RESERVE chunks are already free.
+ **/
+void hbicap_pool_put(struct hbicap_pool_chunk *chunk)
+{
+    mutex_lock(&hbicap_pool_lock);
+    if (hbicap_pool_nr_free < HBICAP_POOL_RESERVE) {
+        list_add(&chunk->list, &hbicap_pool_free);
+        hbicap_pool_nr_free++;
+        chunk = NULL;
+    }
+    mutex_unlock(&hbicap_pool_lock);
+
+    // The reserve is full, the memory goes back to the system
+    if (chunk) {
+        free_pages_exact(chunk->virt, chunk->size);
+        kfree(chunk);
+    }
+}
+
+/**
+ * hbicap_pool_destroy - Release the memory of all free chunks
+ **/
+void hbicap_pool_destroy(void)
+{
+    struct hbicap_pool_chunk *chunk;
+    struct hbicap_pool_chunk *next;
+
+    mutex_lock(&hbicap_pool_lock);
+    list_for_each_entry_safe(chunk, next, &hbicap_pool_free, list) {
+        list_del(&chunk->list);
+        free_pages_exact(chunk->virt, chunk->size);
+        kfree(chunk);
+    }
+    hbicap_pool_nr_free = 0;
+    mutex_unlock(&hbicap_pool_lock);
+}
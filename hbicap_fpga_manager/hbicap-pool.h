@@ -0,0 +1,51 @@
+/**
+* Shared pool of DDR staging chunks for all HBICAP FPGA manager instances
+*
+* In multi-board setups one manager exists per client board, but only a few of them
+* load a bitstream at the same time. Instead of keeping staging buffers per device for
+* the lifetime of the system, the managers borrow chunks from this module-level pool
+* for the duration of a load and return them afterwards. The chunks are plain cached
+* kernel memory that is mapped for the borrowing device with the streaming DMA API.
+* Only a few returned chunks are kept for the next load, the others are freed, so the
+* pool shrinks again after a burst of concurrent loads.
+**/
+#ifndef HBICAP_POOL_H_    /* prevent circular inclusions */
+#define HBICAP_POOL_H_    /* by using protection macros */
+
+#include <linux/types.h>
+#include <linux/list.h>
+
+// Number of free chunks kept in the pool, enough for the staging buffers of one load
+#define HBICAP_POOL_RESERVE 2
+
+// A chunk of the shared staging pool
+struct hbicap_pool_chunk {
+    struct list_head list;  /* entry in the list of free chunks */
+    void *virt;             /* virt. address of the chunk */
+    u32 size;               /* size of the chunk in bytes */
+    bool dma32;             /* the chunk is in the lower 4G of the DDR */
+};
+
+/**
+ * hbicap_pool_get - Borrow a chunk from the pool
+ * @size:  minimum size of the chunk in bytes
+ * @dma32: the chunk must be in the lower 4G of the DDR
+ *
+ * A new chunk is allocated if no free chunk fits. Returns NULL if that fails.
+ **/
+struct hbicap_pool_chunk *hbicap_pool_get(u32 size, bool dma32);
+
+/**
+ * hbicap_pool_put - Return a chunk to the pool
+ * @chunk: the chunk borrowed with hbicap_pool_get
+ *
+ * The chunk is freed if HBICAP_POOL_RESERVE chunks are already free.
+ **/
+void hbicap_pool_put(struct hbicap_pool_chunk *chunk);
+
+/**
+ * hbicap_pool_destroy - Release the memory of all free chunks
+ **/
+void hbicap_pool_destroy(void);
+
+#endif
@@ -0,0 +1,357 @@
+#include "hbicap-readback.h"
+#include "axi-hbicap.h"
+#include "axi-cdma.h"
+
+#include <linux/debugfs.h>
+#include <linux/dma-mapping.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+// NOOPs after the read command, they flush the command out of the ICAP pipeline
+#define HBICAP_READBACK_NOOPS 32
+
+static struct dentry *hbicap_readback_root;    /* debugfs directory of the driver */
+
+// A running readback, one per open readback file
+struct hbicap_readback {
+    struct hbicap_drvdata *drvdata;
+    u32 *buf;                   /* virt. address of the DDR buffer */
+    dma_addr_t buf_phys;        /* DMA address of the DDR buffer */
+    u32 left;                   /* words that are not read yet */
+};
+
+/**
+ * hbicap_readback_commands - Send configuration packets to the ICAP
+ * @drvdata:   a pointer to the drvdata.
+ * @packets:   the packets
+ * @num_words: the number of 32 bit words
+ *
+ * The packets are written by the CPU.
+ **/
+static int hbicap_readback_commands(struct hbicap_drvdata *drvdata, const u32 *packets, u32 num_words)
+{
+    ktime_t deadline;
+    int status;
+
+    deadline = ktime_add_ns(ktime_get(), icap_wait_budget_ns((u64) num_words * 4,
+                            drvdata->icap_clock_hz, drvdata->icap_width));
+
+    axi_hbicap_set_size_register(drvdata, num_words);
+
+    status = axi_hbicap_pio_write(drvdata, packets, num_words, deadline);
+    if (status)
+        return status;
+
+    return axi_hbicap_wait_done(drvdata, deadline);
+}
+
+/**
+ * hbicap_readback_start - Send the readback command sequence and start the read
+ * @drvdata: a pointer to the drvdata.
+ * @far:     the frame address to start at
+ * @words:   the number of words to read
+ **/
+static int hbicap_readback_start(struct hbicap_drvdata *drvdata, u32 far, u32 words)
+{
+    const struct config_registers *regs = drvdata->config_regs;
+    u32 buffer[12 + HBICAP_READBACK_NOOPS];
+    u32 index = 0;
+    int status;
+
+    buffer[index++] = XHI_DUMMY_PACKET;
+    buffer[index++] = XHI_SYNC_PACKET;
+    buffer[index++] = XHI_NOOP_PACKET;
+    buffer[index++] = hwicap_type_1_write(regs->CMD) | 1;
+    buffer[index++] = XHI_CMD_RCRC;
+    buffer[index++] = XHI_NOOP_PACKET;
+    buffer[index++] = hwicap_type_1_write(regs->FAR) | 1;
+    buffer[index++] = far;
+    buffer[index++] = hwicap_type_1_write(regs->CMD) | 1;
+    buffer[index++] = XHI_CMD_RCFG;
+    buffer[index++] = hwicap_type_1_read(regs->FDRO);
+    buffer[index++] = XHI_TYPE_2_READ | (words & XHI_TYPE2_CNT_MASK);
+    while (index < ARRAY_SIZE(buffer))
+        buffer[index++] = XHI_NOOP_PACKET;
+
+    status = hbicap_readback_commands(drvdata, buffer, index);
+    if (status)
+        return status;
+
+    axi_hbicap_start_readback(drvdata, words);
+
+    return 0;
+}
+
+/**
+ * hbicap_readback_desync - Send a DESYNC command to the ICAP
+ * @drvdata: a pointer to the drvdata.
+ **/
+static int hbicap_readback_desync(struct hbicap_drvdata *drvdata)
+{
+    u32 buffer[4];
+    u32 index = 0;
+
+    buffer[index++] = hwicap_type_1_write(drvdata->config_regs->CMD) | 1;
+    buffer[index++] = XHI_CMD_DESYNCH;
+    buffer[index++] = XHI_NOOP_PACKET;
+    buffer[index++] = XHI_NOOP_PACKET;
+
+    return hbicap_readback_commands(drvdata, buffer, index);
+}
+
+/**
+ * hbicap_get_configuration_register - Query a configuration register
+ * @drvdata: a pointer to the drvdata.
+ * @reg:     the configuration register, e.g. drvdata->config_regs->STAT
+ * @value:   returns the value of the register
+ *
+ * The query packets are written by the CPU, the answer is moved by the CDMA into a
+ * small coherent buffer. The ICAP is desynced afterwards. Returns -EOPNOTSUPP without
+ * CDMA registers. Must be called with the mutex held.
+ **/
+int hbicap_get_configuration_register(struct hbicap_drvdata *drvdata, u32 reg, u32 *value)
+{
+    u32 buffer[8];
+    u32 index = 0;
+    int status;
+
+    if (!drvdata->query_buf)
+        return -EOPNOTSUPP;
+    if (drvdata->readback_active)
+        return -EBUSY;
+
+    buffer[index++] = XHI_DUMMY_PACKET;
+    buffer[index++] = XHI_SYNC_PACKET;
+    buffer[index++] = XHI_NOOP_PACKET;
+    buffer[index++] = XHI_NOOP_PACKET;
+    buffer[index++] = hwicap_type_1_read(reg) | 1;
+    buffer[index++] = XHI_NOOP_PACKET;
+    buffer[index++] = XHI_NOOP_PACKET;
+
+    status = hbicap_readback_commands(drvdata, buffer, index);
+    if (status)
+        goto error;
+
+    axi_hbicap_start_readback(drvdata, 1);
+
+    status = axi_cdma_read(drvdata, drvdata->axi_data_phys_base_higher, drvdata->axi_data_phys_base_lower,
+                           upper_32_bits(drvdata->query_phys), lower_32_bits(drvdata->query_phys), 4);
+    if (status) {
+        axi_cdma_reset(drvdata);
+        goto error;
+    }
+    *value = READ_ONCE(*drvdata->query_buf);
+
+    return hbicap_readback_desync(drvdata);
+
+error:
+    axi_hbicap_abort(drvdata);
+    return status;
+}
+
+/**
+ * hbicap_readback_open - Start a readback
+ * @inode: the inode of the readback file
+ * @file:  the opened file
+ **/
+static int hbicap_readback_open(struct inode *inode, struct file *file)
+{
+    struct hbicap_drvdata *drvdata = inode->i_private;
+    struct hbicap_readback *rb;
+    u32 words = drvdata->readback_words;
+    int status;
+
+    // The read data is moved by the CDMA. A DMA engine channel only supports writes.
+    if (drvdata->dma_chan || drvdata->pio_only)
+        return -EOPNOTSUPP;
+
+    // The count of the Type 2 packet limits the words of a readback
+    if (!words || words > XHI_TYPE2_CNT_MASK)
+        return -EINVAL;
+
+    rb = kzalloc(sizeof(*rb), GFP_KERNEL);
+    if (!rb)
+        return -ENOMEM;
+
+    rb->drvdata = drvdata;
+    rb->buf = dma_alloc_noncoherent(drvdata->dma_dev, drvdata->ddr_size, &rb->buf_phys,
+                                    DMA_FROM_DEVICE, GFP_KERNEL);
+    if (!rb->buf) {
+        status = -ENOMEM;
+        goto error_free;
+    }
+
+    status = mutex_lock_interruptible(&drvdata->sem);
+    if (status)
+        goto error_buf;
+
+    // A load may be written in several parts, a readback must not come in between
+    if (drvdata->readback_active || drvdata->load_active) {
+        status = -EBUSY;
+        goto error_unlock;
+    }
+
+    status = hbicap_readback_start(drvdata, drvdata->readback_far, words);
+    if (status) {
+        axi_hbicap_reset(drvdata);
+        goto error_unlock;
+    }
+
+    rb->left = words;
+    drvdata->readback_active = true;
+    mutex_unlock(&drvdata->sem);
+
+    file->private_data = rb;
+    return nonseekable_open(inode, file);
+
+error_unlock:
+    mutex_unlock(&drvdata->sem);
+error_buf:
+    dma_free_noncoherent(drvdata->dma_dev, drvdata->ddr_size, rb->buf, rb->buf_phys, DMA_FROM_DEVICE);
+error_free:
+    kfree(rb);
+    return status;
+}
+
+/**
+ * hbicap_readback_read - Read the next words of a readback
+ * @file:  the opened file
+ * @ubuf:  user space buffer
+ * @count: size of ubuf
+ * @ppos:  file position
+ *
+ * The words are read in chunks of the DDR buffer size. Only whole words are returned.
+ **/
+static ssize_t hbicap_readback_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos)
+{
+    struct hbicap_readback *rb = file->private_data;
+    struct hbicap_drvdata *drvdata = rb->drvdata;
+    ssize_t copied = 0;
+    u32 len;
+    int status;
+
+    status = mutex_lock_interruptible(&drvdata->sem);
+    if (status)
+        return status;
+
+    while (count >= 4 && rb->left > 0) {
+        len = min_t(size_t, count & ~3, drvdata->ddr_size);
+        len = min_t(u32, len, rb->left * 4);
+
+        // Move the words from the read FIFO into the DDR buffer
+        dma_sync_single_for_device(drvdata->dma_dev, rb->buf_phys, len, DMA_FROM_DEVICE);
+        status = axi_cdma_read(drvdata, drvdata->axi_data_phys_base_higher, drvdata->axi_data_phys_base_lower,
+                               upper_32_bits(rb->buf_phys), lower_32_bits(rb->buf_phys), len);
+        if (status) {
+            dev_err(drvdata->dma_dev, "CDMA readback was not successfull\n");
+            axi_cdma_reset(drvdata);
+            status = -EIO;
+            break;
+        }
+        dma_sync_single_for_cpu(drvdata->dma_dev, rb->buf_phys, len, DMA_FROM_DEVICE);
+
+        rb->left -= len / 4;
+
+        if (copy_to_user(ubuf + copied, rb->buf, len)) {
+            status = -EFAULT;
+            break;
+        }
+
+        copied += len;
+        count  -= len;
+    }
+
+    mutex_unlock(&drvdata->sem);
+
+    *ppos += copied;
+    return copied ? copied : status;
+}
+
+/**
+ * hbicap_readback_release - Finish or abort a readback
+ * @inode: the inode of the readback file
+ * @file:  the opened file
+ **/
+static int hbicap_readback_release(struct inode *inode, struct file *file)
+{
+    struct hbicap_readback *rb = file->private_data;
+    struct hbicap_drvdata *drvdata = rb->drvdata;
+
+    mutex_lock(&drvdata->sem);
+
+    // The ICAP still sends words if the readback was not read to the end
+    if (rb->left > 0)
+        axi_hbicap_abort(drvdata);
+
+    if (hbicap_readback_desync(drvdata))
+        dev_warn(drvdata->dma_dev, "Couldn't desync the ICAP after the readback\n");
+
+    drvdata->readback_active = false;
+    mutex_unlock(&drvdata->sem);
+
+    dma_free_noncoherent(drvdata->dma_dev, drvdata->ddr_size, rb->buf, rb->buf_phys, DMA_FROM_DEVICE);
+    kfree(rb);
+
+    return 0;
+}
+
+static const struct file_operations hbicap_readback_fops = {
+    .owner   = THIS_MODULE,
+    .open    = hbicap_readback_open,
+    .read    = hbicap_readback_read,
+    .release = hbicap_readback_release,
+    .llseek  = no_llseek,
+};
+
+/**
+ * hbicap_readback_debugfs_init - Create the debugfs directory of the driver
+ **/
+void hbicap_readback_debugfs_init(void)
+{
+    hbicap_readback_root = debugfs_create_dir("hbicap_fpga_manager", NULL);
+}
+
+/**
+ * hbicap_readback_debugfs_exit - Remove the debugfs directory of the driver
+ **/
+void hbicap_readback_debugfs_exit(void)
+{
+    debugfs_remove_recursive(hbicap_readback_root);
+}
+
+/**
+ * hbicap_readback_unregister - Remove the debugfs files of a device
+ * @data: the debugfs directory of the device
+ **/
+static void hbicap_readback_unregister(void *data)
+{
+    debugfs_remove_recursive(data);
+}
+
+/**
+ * hbicap_readback_register - Create the debugfs files of a device
+ * @dev:     the HBICAP device
+ * @drvdata: a pointer to the drvdata.
+ *
+ * The files are removed when the device is unbound.
+ **/
+int hbicap_readback_register(struct device *dev, struct hbicap_drvdata *drvdata)
+{
+    struct dentry *dir;
+
+    // Target of the CDMA for configuration register queries
+    if (!drvdata->dma_chan && !drvdata->pio_only) {
+        drvdata->query_buf = dmam_alloc_coherent(drvdata->dma_dev, sizeof(u32),
+                                                 &drvdata->query_phys, GFP_KERNEL);
+        if (!drvdata->query_buf)
+            return -ENOMEM;
+    }
+
+    dir = debugfs_create_dir(dev_name(dev), hbicap_readback_root);
+    debugfs_create_x32("far", 0600, dir, &drvdata->readback_far);
+    debugfs_create_u32("words", 0600, dir, &drvdata->readback_words);
+    debugfs_create_file("readback", 0400, dir, drvdata, &hbicap_readback_fops);
+
+    return devm_add_action_or_reset(dev, hbicap_readback_unregister, dir);
+}
@@ -0,0 +1,54 @@
+/**
+* Configuration readback for the AXI HBICAP FPGA manager
+*
+* The frames starting at a frame address are read from the FDRO register of the ICAP. The
+* HBICAP puts the words into its read FIFO and the AXI CDMA moves them from the AXI data port
+* into a DDR buffer, from where they are copied to user space chunk by chunk.
+*
+* The readback is controlled through debugfs:
+*   /sys/kernel/debug/hbicap_fpga_manager/<device>/far      frame address to start at
+*   /sys/kernel/debug/hbicap_fpga_manager/<device>/words    number of words to read, incl. pad words
+*   /sys/kernel/debug/hbicap_fpga_manager/<device>/readback the read words
+*
+* Opening the readback file starts the readback, it is finished or aborted when the file is
+* closed. No bitstream can be loaded in the meantime.
+**/
+#ifndef HBICAP_READBACK_H_    /* prevent circular inclusions */
+#define HBICAP_READBACK_H_    /* by using protection macros */
+
+#include <linux/types.h>
+#include <linux/platform_device.h>
+
+#include "hbicap-fpga.h"
+
+/**
+ * hbicap_readback_debugfs_init - Create the debugfs directory of the driver
+ **/
+void hbicap_readback_debugfs_init(void);
+
+/**
+ * hbicap_readback_debugfs_exit - Remove the debugfs directory of the driver
+ **/
+void hbicap_readback_debugfs_exit(void);
+
+/**
+ * hbicap_readback_register - Create the debugfs files of a device
+ * @dev:     the HBICAP device
+ * @drvdata: a pointer to the drvdata.
+ *
+ * The files are removed when the device is unbound. Also allocates the buffer for
+ * configuration register queries.
+ **/
+int hbicap_readback_register(struct device *dev, struct hbicap_drvdata *drvdata);
+
+/**
+ * hbicap_get_configuration_register - Query a configuration register
+ * @drvdata: a pointer to the drvdata.
+ * @reg:     the configuration register, e.g. drvdata->config_regs->STAT
+ * @value:   returns the value of the register
+ *
+ * Needs the CDMA registers. Must be called with the mutex held.
+ **/
+int hbicap_get_configuration_register(struct hbicap_drvdata *drvdata, u32 reg, u32 *value);
+
+#endif
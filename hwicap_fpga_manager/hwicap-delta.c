@@ -0,0 +1,514 @@
+#include "hwicap-delta.h"
+
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/xxhash.h>
+
+/* Words that are converted at once by the scan */
+#define HWICAP_DELTA_SCAN_WORDS 64
+
+enum hwicap_delta_state {
+    HWICAP_DELTA_IDLE,          /* no load running, the records are valid */
+    HWICAP_DELTA_SCAN,          /* load started, the bitstream is not scanned yet */
+    HWICAP_DELTA_WRITE,         /* bitstream scanned, it is recorded after the load */
+    HWICAP_DELTA_OFF,           /* bitstream written as it is, the records are forgotten */
+};
+
+/* A FAR write and the FDRI writes that follow it */
+struct hwicap_delta_burst {
+    u32 far;                    /* frame address of the first frame */
+    u32 words;                  /* FDRI words */
+    u64 hash;                   /* xxh64 of the FDRI words */
+};
+
+/* The bursts of the last bitstream loaded into a region */
+struct hwicap_delta_region {
+    u32 count;                  /* bursts, 0 for a free entry */
+    struct hwicap_delta_burst bursts[HWICAP_DELTA_BURSTS];
+};
+
+/* Position in the packets of a bitstream, the scan and the write parse them the same way */
+struct hwicap_delta_parser {
+    u32 reg;                    /* register of the current packet */
+    u32 words;                  /* data words of the current packet still to come */
+    int burst;                  /* index of the current burst, -1 before the first */
+    bool in_burst;              /* the packets belong to the current burst */
+    bool fdri;                  /* the current burst has FDRI packets */
+    bool synced;                /* the sync word was seen and no DESYNC command since */
+};
+
+struct hwicap_delta {
+    const struct config_registers *regs;
+    enum hwicap_delta_state state;
+    struct hwicap_delta_region regions[HWICAP_DELTA_REGIONS];
+    int victim;                 /* record that is replaced next if all are used */
+
+    /* Scan of the bitstream of the current load */
+    struct hwicap_delta_region scan;
+    struct hwicap_delta_parser parser;
+    struct xxh64_state hash;    /* hash of the FDRI words of the current burst */
+    size_t skip_bytes;          /* bytes before the sync word that are not scanned */
+    enum icap_swap swap;        /* conversion of the words */
+    u8 carry[4];                /* bytes of an incomplete word */
+    u32 carry_len;
+    bool overflow;              /* the bursts can't be tracked */
+    bool crc_used;              /* the bitstream has CRC packets that are checked */
+    bool desynced;              /* the scan reached the DESYNC command */
+    int region;                 /* record with the layout of the bitstream, -1 if none */
+    bool skip[HWICAP_DELTA_BURSTS]; /* the burst is dropped */
+    bool active;                /* bursts are dropped in this load */
+
+    /* Rewrite of the bitstream */
+    u32 crc;                    /* CRC of the written register data since the last RCRC */
+    u32 crc_word;               /* rewritten value of a CRC packet */
+};
+
+/**
+ * hwicap_delta_forget - Forget the records of all regions.
+ * @delta: the records of the device.
+ */
+static void hwicap_delta_forget(struct hwicap_delta *delta)
+{
+    int i;
+
+    for (i = 0; i < HWICAP_DELTA_REGIONS; i++)
+        delta->regions[i].count = 0;
+}
+
+/**
+ * hwicap_delta_header - Parse a packet header.
+ * @delta: the records of the device.
+ * @p: the position in the packets.
+ * @word: the packet header.
+ *
+ * Returns: true if the header belongs to a FAR or FDRI packet of the
+ * current burst.
+ */
+static bool hwicap_delta_header(struct hwicap_delta *delta,
+        struct hwicap_delta_parser *p, u32 word)
+{
+    const struct config_registers *regs = delta->regs;
+    u32 type = (word >> XHI_TYPE_SHIFT) & XHI_TYPE_MASK;
+    u32 op = (word >> XHI_OP_SHIFT) & XHI_OP_MASK;
+    u32 count;
+
+    if (type == XHI_TYPE_1) {
+        p->reg = (word >> XHI_REGISTER_SHIFT) & ICAP_CRC_REGISTER_MASK;
+        count = word & XHI_WORD_COUNT_MASK_TYPE_1;
+    } else if (type == XHI_TYPE_2) {
+        /* Continues the register of the last Type 1 packet. */
+        count = word & XHI_TYPE2_CNT_MASK;
+    } else {
+        return false;
+    }
+
+    /* Only writes are followed by data words. */
+    if (op != XHI_OP_WRITE)
+        return false;
+    p->words = count;
+
+    /* A FAR write starts the next burst. */
+    if (type == XHI_TYPE_1 && p->reg == regs->FAR) {
+        p->burst++;
+        p->in_burst = true;
+        p->fdri = false;
+        return true;
+    }
+
+    if (p->reg == regs->FDRI) {
+        p->fdri = p->in_burst;
+        return p->in_burst;
+    }
+
+    /* A write to another register ends a burst with frame data. */
+    if (count > 0 && p->fdri)
+        p->in_burst = false;
+
+    return false;
+}
+
+/**
+ * hwicap_delta_end_burst - Store the hash of a scanned burst.
+ * @delta: the records of the device.
+ * @burst: index of the burst, the hash is not stored if it is not tracked.
+ */
+static void hwicap_delta_end_burst(struct hwicap_delta *delta, int burst)
+{
+    if (burst >= 0 && burst < HWICAP_DELTA_BURSTS)
+        delta->scan.bursts[burst].hash = xxh64_digest(&delta->hash);
+}
+
+/**
+ * hwicap_delta_scan_words - Scan whole words of the bitstream.
+ * @delta: the records of the device.
+ * @data: the words, in the order of the ICAP.
+ * @num_words: the number of words.
+ */
+static void hwicap_delta_scan_words(struct hwicap_delta *delta,
+        const u32 *data, u32 num_words)
+{
+    const struct config_registers *regs = delta->regs;
+    struct hwicap_delta_parser *p = &delta->parser;
+    struct hwicap_delta_burst *burst;
+    u32 word;
+    u32 n;
+
+    while (num_words > 0 && !delta->overflow) {
+        word = *data;
+
+        /* The words before the sync word are not parsed. */
+        if (!p->synced) {
+            p->synced = (word == XHI_SYNC_PACKET);
+            data++;
+            num_words--;
+            continue;
+        }
+
+        if (p->words == 0) {
+            if (hwicap_delta_header(delta, p, word) && p->reg == regs->FAR) {
+                hwicap_delta_end_burst(delta, p->burst - 1);
+                if (p->burst >= HWICAP_DELTA_BURSTS || p->words != 1) {
+                    delta->overflow = true;
+                    break;
+                }
+
+                burst = &delta->scan.bursts[p->burst];
+                burst->words = 0;
+                delta->scan.count = p->burst + 1;
+                xxh64_reset(&delta->hash, 0);
+            }
+            data++;
+            num_words--;
+            continue;
+        }
+
+        /* Runs of data words are handled at once. */
+        n = min(p->words, num_words);
+        burst = &delta->scan.bursts[p->burst < 0 ? 0 : p->burst];
+
+        if (p->reg == regs->FDRI && p->in_burst) {
+            xxh64_update(&delta->hash, data, n << 2);
+            burst->words += n;
+        } else if (p->reg == regs->FAR && p->in_burst) {
+            n = 1;
+            burst->far = word;
+        } else if (p->reg == regs->CRC) {
+            n = 1;
+            if (word != XHI_DISABLED_AUTO_CRC)
+                delta->crc_used = true;
+        } else if (p->reg == regs->CMD) {
+            n = 1;
+            if (word == XHI_CMD_DESYNCH) {
+                p->synced = false;
+                p->in_burst = false;
+                delta->desynced = true;
+            }
+        }
+
+        p->words -= n;
+        data += n;
+        num_words -= n;
+    }
+}
+
+/**
+ * hwicap_delta_parser_init - Start parsing a bitstream.
+ * @p: the position in the packets.
+ */
+static void hwicap_delta_parser_init(struct hwicap_delta_parser *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->burst = -1;
+}
+
+void hwicap_delta_begin(struct hwicap_delta *delta, bool enable,
+        size_t skip_bytes, enum icap_swap swap)
+{
+    /* The frames written by an unfinished load are unknown. */
+    if (delta->state != HWICAP_DELTA_IDLE)
+        hwicap_delta_forget(delta);
+
+    delta->active = false;
+    if (!enable) {
+        hwicap_delta_forget(delta);
+        delta->state = HWICAP_DELTA_OFF;
+        return;
+    }
+
+    hwicap_delta_parser_init(&delta->parser);
+    delta->scan.count = 0;
+    delta->skip_bytes = skip_bytes;
+    delta->swap = swap;
+    delta->carry_len = 0;
+    delta->overflow = false;
+    delta->crc_used = false;
+    delta->desynced = false;
+    delta->state = HWICAP_DELTA_SCAN;
+}
+
+bool hwicap_delta_scanning(struct hwicap_delta *delta)
+{
+    return delta->state == HWICAP_DELTA_SCAN;
+}
+
+void hwicap_delta_scan(struct hwicap_delta *delta, const u8 *data, size_t size)
+{
+    u32 block[HWICAP_DELTA_SCAN_WORDS];
+    size_t len;
+    u32 words;
+
+    /* The same bytes are dropped as by hwicap_write_data. */
+    len = min(delta->skip_bytes, size);
+    delta->skip_bytes -= len;
+    data += len;
+    size -= len;
+
+    if (delta->carry_len) {
+        len = min_t(size_t, 4 - delta->carry_len, size);
+        memcpy(delta->carry + delta->carry_len, data, len);
+        delta->carry_len += len;
+        data += len;
+        size -= len;
+        if (delta->carry_len < 4)
+            return;
+
+        memcpy(block, delta->carry, 4);
+        icap_swap_words(block, 1, delta->swap);
+        hwicap_delta_scan_words(delta, block, 1);
+        delta->carry_len = 0;
+    }
+
+    /* Words in the order of the ICAP are scanned where they are. */
+    if (IS_ALIGNED((unsigned long)data, 4) && delta->swap == ICAP_SWAP_NONE) {
+        words = min_t(size_t, size >> 2, U32_MAX);
+        hwicap_delta_scan_words(delta, (const u32 *)data, words);
+        data += (size_t)words << 2;
+        size -= (size_t)words << 2;
+    }
+
+    while (size > 3) {
+        words = min_t(size_t, size >> 2, HWICAP_DELTA_SCAN_WORDS);
+        memcpy(block, data, words << 2);
+        icap_swap_words(block, words, delta->swap);
+        hwicap_delta_scan_words(delta, block, words);
+        data += words << 2;
+        size -= words << 2;
+    }
+
+    memcpy(delta->carry, data, size);
+    delta->carry_len = size;
+}
+
+int hwicap_delta_prepare(struct hwicap_delta *delta, u32 *bursts)
+{
+    struct hwicap_delta_region *scan = &delta->scan;
+    struct hwicap_delta_region *record;
+    int dropped = 0;
+    int i;
+    int j;
+
+    hwicap_delta_end_burst(delta, delta->parser.burst);
+    *bursts = scan->count;
+
+    /* Only a complete bitstream tells which frames it writes. */
+    if (delta->overflow || !delta->desynced) {
+        hwicap_delta_forget(delta);
+        delta->state = HWICAP_DELTA_OFF;
+        return -1;
+    }
+
+    delta->region = -1;
+    memset(delta->skip, 0, sizeof(delta->skip));
+    for (i = 0; i < HWICAP_DELTA_REGIONS && delta->region < 0; i++) {
+        record = &delta->regions[i];
+        if (!scan->count || record->count != scan->count)
+            continue;
+
+        for (j = 0; j < scan->count; j++) {
+            if (record->bursts[j].far != scan->bursts[j].far ||
+                record->bursts[j].words != scan->bursts[j].words)
+                break;
+        }
+        if (j == scan->count)
+            delta->region = i;
+    }
+
+    /*
+     * Bursts without frame data are always written, and so are the BRAM
+     * contents: the design changes them, so the hash of the last bitstream
+     * doesn't tell what the frames hold.
+     */
+    if (delta->region >= 0) {
+        record = &delta->regions[delta->region];
+        for (j = 0; j < scan->count; j++) {
+            delta->skip[j] = scan->bursts[j].words > 0 &&
+                    ((scan->bursts[j].far >> XHI_FAR_BLOCK_SHIFT) &
+                     XHI_FAR_BLOCK_MASK) != XHI_FAR_BRAM_BLOCK &&
+                    record->bursts[j].hash == scan->bursts[j].hash;
+            dropped += delta->skip[j];
+        }
+    }
+
+    hwicap_delta_parser_init(&delta->parser);
+    delta->crc = 0;
+    delta->active = (dropped > 0);
+    delta->state = HWICAP_DELTA_WRITE;
+
+    return dropped;
+}
+
+bool hwicap_delta_active(struct hwicap_delta *delta)
+{
+    return delta->active;
+}
+
+/**
+ * hwicap_delta_flush - Write the words that are not dropped.
+ * @drvdata: a pointer to the drvdata.
+ * @data: the words.
+ * @num_words: the number of words.
+ *
+ * Returns: '0' on success and failure value on error
+ */
+static int hwicap_delta_flush(struct hwicap_drvdata *drvdata,
+        const u32 *data, u32 num_words)
+{
+    if (!num_words)
+        return 0;
+
+    return drvdata->config->set_configuration(drvdata, data, num_words);
+}
+
+int hwicap_delta_write(struct hwicap_drvdata *drvdata, const u32 *data,
+        u32 num_words)
+{
+    struct hwicap_delta *delta = drvdata->delta;
+    const struct config_registers *regs = delta->regs;
+    struct hwicap_delta_parser *p = &delta->parser;
+    const u32 *run = data;      /* first word that is not written yet */
+    bool drop;
+    u32 word;
+    u32 i;
+    u32 n;
+    int status;
+
+    while (num_words > 0) {
+        word = *data;
+        n = 1;
+        drop = false;
+
+        if (!p->synced) {
+            p->synced = (word == XHI_SYNC_PACKET);
+        } else if (p->words == 0) {
+            drop = hwicap_delta_header(delta, p, word) && delta->skip[p->burst];
+        } else {
+            if (p->reg != regs->CRC && p->reg != regs->CMD)
+                n = min(p->words, num_words);
+            p->words -= n;
+
+            drop = p->in_burst && delta->skip[p->burst] &&
+                   (p->reg == regs->FAR || p->reg == regs->FDRI);
+            if (!drop && p->reg == regs->CRC) {
+                /* The CRC of the bitstream covers the dropped words. */
+                if (word != XHI_DISABLED_AUTO_CRC && word != delta->crc) {
+                    status = hwicap_delta_flush(drvdata, run, data - run);
+                    if (status)
+                        return status;
+
+                    delta->crc_word = delta->crc;
+                    status = hwicap_delta_flush(drvdata, &delta->crc_word, 1);
+                    if (status)
+                        return status;
+                    run = data + 1;
+                }
+            } else if (!drop) {
+                if (delta->crc_used) {
+                    for (i = 0; i < n; i++)
+                        delta->crc = icap_crc_add(delta->crc, p->reg, data[i]);
+                }
+
+                if (p->reg == regs->CMD && word == XHI_CMD_RCRC) {
+                    delta->crc = 0;
+                } else if (p->reg == regs->CMD && word == XHI_CMD_DESYNCH) {
+                    p->synced = false;
+                    p->in_burst = false;
+                }
+            }
+        }
+
+        if (drop) {
+            status = hwicap_delta_flush(drvdata, run, data - run);
+            if (status)
+                return status;
+            run = data + n;
+        }
+
+        data += n;
+        num_words -= n;
+    }
+
+    return hwicap_delta_flush(drvdata, run, data - run);
+}
+
+void hwicap_delta_commit(struct hwicap_delta *delta)
+{
+    struct hwicap_delta_region *scan = &delta->scan;
+    int region = delta->region;
+    int i;
+    int j;
+    int k;
+
+    if (delta->state == HWICAP_DELTA_WRITE && scan->count) {
+        /* A record with another layout at the same frames is replaced. */
+        if (region < 0) {
+            for (i = 0; i < HWICAP_DELTA_REGIONS; i++) {
+                for (j = 0; j < delta->regions[i].count; j++) {
+                    for (k = 0; k < scan->count; k++) {
+                        if (delta->regions[i].bursts[j].far == scan->bursts[k].far)
+                            break;
+                    }
+                    if (k < scan->count)
+                        break;
+                }
+                if (j < delta->regions[i].count)
+                    delta->regions[i].count = 0;
+            }
+
+            for (i = 0; i < HWICAP_DELTA_REGIONS && region < 0; i++) {
+                if (!delta->regions[i].count)
+                    region = i;
+            }
+            if (region < 0) {
+                region = delta->victim;
+                delta->victim = (delta->victim + 1) % HWICAP_DELTA_REGIONS;
+            }
+        }
+
+        delta->regions[region].count = scan->count;
+        memcpy(delta->regions[region].bursts, scan->bursts,
+               scan->count * sizeof(scan->bursts[0]));
+    }
+
+    delta->active = false;
+    delta->state = HWICAP_DELTA_IDLE;
+}
+
+static void hwicap_delta_unregister(void *data)
+{
+    kvfree(data);
+}
+
+int hwicap_delta_register(struct device *dev, struct hwicap_drvdata *drvdata)
+{
+    struct hwicap_delta *delta;
+
+    delta = kvzalloc(sizeof(*delta), GFP_KERNEL);
+    if (!delta)
+        return -ENOMEM;
+
+    delta->regs = drvdata->config_regs;
+    delta->state = HWICAP_DELTA_IDLE;
+    drvdata->delta = delta;
+
+    return devm_add_action_or_reset(dev, hwicap_delta_unregister, delta);
+}
@@ -0,0 +1,78 @@
+/*
+ * Differential loads for the AXI HWICAP FPGA manager
+ *
+ * Partial bitstreams of a reconfigurable region write the same frames, and
+ * designs that are close to each other differ only in a part of them. With
+ * the delta_load module parameter, the driver remembers what the loaded
+ * bitstreams wrote and drops the parts of a new bitstream that would not
+ * change anything, so they don't use up the bandwidth of the ICAP.
+ *
+ * The unit is a burst: a write of the FAR register and the FDRI writes that
+ * follow it, which write consecutive frames starting at the frame address.
+ * The address of a frame inside a burst depends on the layout of the device,
+ * so a burst can only be dropped as a whole. The record of a region is the
+ * list of bursts of the last bitstream loaded into it, with their frame
+ * address, their length and a hash (xxh64) of their frame data. A bitstream
+ * whose bursts have the same addresses and lengths as a record is loaded into
+ * that region, and its bursts with the same hash are dropped. The CRC packets
+ * are rewritten to match the words that are written.
+ *
+ * The record describes the last bitstream, not the frames in the device. The
+ * BRAM contents (FAR block type 1) are changed by the running design, so
+ * these bursts are always written and a load still restores the initial
+ * memory contents. LUTRAM and SRL contents are in the CLB frames and are not
+ * restored if the frame is dropped. Frames written by any other path than
+ * this driver, or changed by the design, make the record wrong: a load
+ * without delta_load forgets the records.
+ *
+ * The bitstream is scanned before its first word is written, so it has to be
+ * passed to the first write op (or to write_sg) as a whole and must not be
+ * compressed. Otherwise, and after a failed load, all records are forgotten
+ * and the bitstream is written as it is. Bitstreams with different layouts
+ * are taken to write different frames, as the regions of a design do. A
+ * bitstream that starts a burst at the address of a burst of a record, but
+ * has another layout, replaces the record.
+ */
+#ifndef HWICAP_DELTA_H_    /* prevent circular inclusions */
+#define HWICAP_DELTA_H_    /* by using protection macros */
+
+#include <linux/types.h>
+#include <linux/platform_device.h>
+
+#include "hwicap-fpga.h"
+
+/* Bursts of a bitstream that are tracked, larger bitstreams are written as they are */
+#define HWICAP_DELTA_BURSTS  128
+
+/* Regions with a record */
+#define HWICAP_DELTA_REGIONS 8
+
+/* Allocate the records of a device, they are freed when the device is unbound. */
+int hwicap_delta_register(struct device *dev, struct hwicap_drvdata *drvdata);
+
+/* Start a load. Without enable, the bitstream is written as it is and the records are forgotten. */
+void hwicap_delta_begin(struct hwicap_delta *delta, bool enable,
+        size_t skip_bytes, enum icap_swap swap);
+
+/* True until the bitstream of the load was scanned. */
+bool hwicap_delta_scanning(struct hwicap_delta *delta);
+
+/* Scan the next part of the bitstream, as it is passed to the write ops. */
+void hwicap_delta_scan(struct hwicap_delta *delta, const u8 *data, size_t size);
+
+/* Finish the scan. Returns the number of bursts that are dropped, or -1 if
+ * the bitstream is written as it is.
+ */
+int hwicap_delta_prepare(struct hwicap_delta *delta, u32 *bursts);
+
+/* True if words of the bitstream are dropped. */
+bool hwicap_delta_active(struct hwicap_delta *delta);
+
+/* Write the words of the bitstream that are not dropped. */
+int hwicap_delta_write(struct hwicap_drvdata *drvdata, const u32 *data,
+        u32 num_words);
+
+/* Record the bitstream after a successful load. */
+void hwicap_delta_commit(struct hwicap_delta *delta);
+
+#endif
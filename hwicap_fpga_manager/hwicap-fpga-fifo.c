@@ -34,7 +34,7 @@
 #define XHI_IPIXR_RFULL_MASK 0x00000008 /* Read FIFO Full */
 #define XHI_IPIXR_WEMPTY_MASK 0x00000004 /* Write FIFO Empty */
 #define XHI_IPIXR_RDP_MASK 0x00000002 /* Read FIFO half full */
-#define XHI_IPIXR_WRP_MASK 0x00000001 /* Write FIFO half full */
+#define XHI_IPIXR_WRP_MASK 0x00000001 /* Write FIFO half empty */
 #define XHI_IPIXR_ALL_MASK 0x0000000F /* Mask of all interrupts */
 
 /* Control Register (CR) */
@@ -52,28 +52,54 @@
 
 
 /**
- * fifo_icap_fifo_write - Write data to the write FIFO.
+ * fifo_icap_regs_init - Set up the register access of the device.
  * @drvdata: a pointer to the drvdata.
- * @data: the 32-bit value to be written to the FIFO.
  *
- * This function will silently fail if the fifo is full.
+ * The control and interrupt enable registers only change when they are
+ * written by the driver, so they are shadowed. The read and write bits
+ * of the control register are cleared by the device.
+ **/
+void fifo_icap_regs_init(struct hwicap_drvdata *drvdata)
+{
+    struct icap_regs *regs = &drvdata->regs;
+
+    icap_regs_init(regs, drvdata->base_address);
+    icap_regs_cache(regs, XHI_CR_OFFSET, XHI_CR_READ_MASK | XHI_CR_WRITE_MASK);
+    icap_regs_cache(regs, XHI_GIER_OFFSET, 0);
+    icap_regs_cache(regs, XHI_IPIER_OFFSET, 0);
+}
+
+/**
+ * fifo_icap_fifo_write - Write a burst of data to the write FIFO.
+ * @drvdata: a pointer to the drvdata.
+ * @data: the 32-bit values to be written to the FIFO.
+ * @num_words: the number of values.
+ *
+ * The words are written without barriers, fifo_icap_start_config has the
+ * barrier for the whole burst. This function will silently fail if the fifo
+ * is full.
  **/
 static inline void fifo_icap_fifo_write(struct hwicap_drvdata *drvdata,
-        u32 data)
+        const u32 *data, u32 num_words)
 {
-    iowrite32le(data, drvdata->base_address + XHI_WF_OFFSET);
+    iowrite32_rep(drvdata->base_address + XHI_WF_OFFSET, data, num_words);
+    drvdata->regs.writes += num_words;
 }
 
 /**
- * fifo_icap_fifo_read - Read data from the Read FIFO.
+ * fifo_icap_fifo_read - Read a burst of data from the Read FIFO.
  * @drvdata: a pointer to the drvdata.
+ * @data: returns the 32-bit values read from the FIFO.
+ * @num_words: the number of values.
  *
- * This function will silently fail if the fifo is empty.
+ * The words are read without barriers, the occupancy read before orders
+ * them. This function will silently fail if the fifo is empty.
  **/
-static inline u32 fifo_icap_fifo_read(struct hwicap_drvdata *drvdata)
+static inline void fifo_icap_fifo_read(struct hwicap_drvdata *drvdata,
+        u32 *data, u32 num_words)
 {
-    u32 data = ioread32le(drvdata->base_address + XHI_RF_OFFSET);
-    return data;
+    ioread32_rep(drvdata->base_address + XHI_RF_OFFSET, data, num_words);
+    drvdata->regs.reads += num_words;
 }
 
 /**
@@ -84,16 +110,19 @@ static inline u32 fifo_icap_fifo_read(struct hwicap_drvdata *drvdata)
 static inline void fifo_icap_set_read_size(struct hwicap_drvdata *drvdata,
         u32 data)
 {
-    iowrite32le(data, drvdata->base_address + XHI_SZ_OFFSET);
+    icap_reg_write_relaxed(&drvdata->regs, XHI_SZ_OFFSET, data);
 }
 
 /**
  * fifo_icap_start_config - Initiate a configuration (write) to the device.
  * @drvdata: a pointer to the drvdata.
+ *
+ * The words for the write FIFO are written relaxed. This write has the barrier
+ * for all of them.
  **/
 static inline void fifo_icap_start_config(struct hwicap_drvdata *drvdata)
 {
-    iowrite32le(XHI_CR_WRITE_MASK, drvdata->base_address + XHI_CR_OFFSET);
+    icap_reg_write(&drvdata->regs, XHI_CR_OFFSET, XHI_CR_WRITE_MASK);
 }
 
 /**
@@ -102,7 +131,7 @@ static inline void fifo_icap_start_config(struct hwicap_drvdata *drvdata)
  **/
 static inline void fifo_icap_start_readback(struct hwicap_drvdata *drvdata)
 {
-    iowrite32le(XHI_CR_READ_MASK, drvdata->base_address + XHI_CR_OFFSET);
+    icap_reg_write(&drvdata->regs, XHI_CR_OFFSET, XHI_CR_READ_MASK);
 }
 
 /**
@@ -117,7 +146,7 @@ static inline void fifo_icap_start_readback(struct hwicap_drvdata *drvdata)
  **/
 u32 fifo_icap_get_status(struct hwicap_drvdata *drvdata)
 {
-    u32 status = ioread32le(drvdata->base_address + XHI_SR_OFFSET);
+    u32 status = icap_reg_read(&drvdata->regs, XHI_SR_OFFSET);
     return status;
 }
 
@@ -127,7 +156,7 @@ u32 fifo_icap_get_status(struct hwicap_drvdata *drvdata)
  **/
 static inline u32 fifo_icap_busy(struct hwicap_drvdata *drvdata)
 {
-    u32 status = ioread32le(drvdata->base_address + XHI_SR_OFFSET);
+    u32 status = icap_reg_read(&drvdata->regs, XHI_SR_OFFSET);
     return (status & XHI_SR_DONE_MASK) ? 0 : 1;
 }
 
@@ -140,7 +169,7 @@ static inline u32 fifo_icap_busy(struct hwicap_drvdata *drvdata)
 static inline u32 fifo_icap_write_fifo_vacancy(
         struct hwicap_drvdata *drvdata)
 {
-    return ioread32le(drvdata->base_address + XHI_WFV_OFFSET);
+    return icap_reg_read(&drvdata->regs, XHI_WFV_OFFSET);
 }
 
 /**
@@ -152,7 +181,151 @@ static inline u32 fifo_icap_write_fifo_vacancy(
 static inline u32 fifo_icap_read_fifo_occupancy(
         struct hwicap_drvdata *drvdata)
 {
-    return ioread32le(drvdata->base_address + XHI_RFO_OFFSET);
+    return icap_reg_read(&drvdata->regs, XHI_RFO_OFFSET);
+}
+
+/**
+ * fifo_icap_enable_interrupts - Enable interrupts of the device.
+ * @drvdata: a pointer to the drvdata.
+ * @mask: the interrupts to enable.
+ *
+ * Pending interrupts are cleared before they are enabled.
+ **/
+static void fifo_icap_enable_interrupts(struct hwicap_drvdata *drvdata,
+        u32 mask)
+{
+    u32 pending;
+
+    /* IPISR bits toggle on write */
+    pending = icap_reg_read(&drvdata->regs, XHI_IPISR_OFFSET);
+    if (pending & XHI_IPIXR_ALL_MASK)
+        icap_reg_write_relaxed(&drvdata->regs, XHI_IPISR_OFFSET,
+                               pending & XHI_IPIXR_ALL_MASK);
+
+    icap_reg_update(&drvdata->regs, XHI_IPIER_OFFSET, mask);
+    icap_reg_update(&drvdata->regs, XHI_GIER_OFFSET, XHI_GIER_GIE_MASK);
+}
+
+/**
+ * fifo_icap_disable_interrupts - Disable all interrupts of the device.
+ * @drvdata: a pointer to the drvdata.
+ **/
+void fifo_icap_disable_interrupts(struct hwicap_drvdata *drvdata)
+{
+    icap_reg_update(&drvdata->regs, XHI_GIER_OFFSET, 0);
+    icap_reg_update(&drvdata->regs, XHI_IPIER_OFFSET, 0);
+}
+
+/**
+ * fifo_icap_refill - Write the next words of an interrupt driven transfer.
+ * @drvdata: a pointer to the drvdata.
+ *
+ * As many words are written as the write FIFO has space for, then the
+ * transfer of the FIFO to the ICAP is started.
+ **/
+static void fifo_icap_refill(struct hwicap_drvdata *drvdata)
+{
+    u32 words_to_write;
+
+    words_to_write = min(fifo_icap_write_fifo_vacancy(drvdata),
+                         drvdata->irq_words);
+    if (words_to_write == 0)
+        return;
+
+    fifo_icap_fifo_write(drvdata, drvdata->irq_data, words_to_write);
+    drvdata->irq_data += words_to_write;
+    drvdata->irq_words -= words_to_write;
+
+    fifo_icap_start_config(drvdata);
+}
+
+/**
+ * fifo_icap_irq_thread - Threaded interrupt handler of the device.
+ * @irq: the interrupt number.
+ * @dev_id: a pointer to the drvdata.
+ *
+ * The write FIFO is refilled when it is half empty. When all words are in
+ * the FIFO, only the write FIFO empty interrupt stays enabled and wakes up
+ * the thread in fifo_icap_set_configuration.
+ **/
+irqreturn_t fifo_icap_irq_thread(int irq, void *dev_id)
+{
+    struct hwicap_drvdata *drvdata = dev_id;
+    u32 enabled = icap_reg_read(&drvdata->regs, XHI_IPIER_OFFSET);
+    u32 pending;
+
+    pending = icap_reg_read(&drvdata->regs, XHI_IPISR_OFFSET) & enabled;
+    if (!pending)
+        return IRQ_NONE;
+
+    icap_reg_write_relaxed(&drvdata->regs, XHI_IPISR_OFFSET, pending);
+
+    if (drvdata->irq_words > 0) {
+        fifo_icap_refill(drvdata);
+        if (drvdata->irq_words == 0)
+            icap_reg_update(&drvdata->regs, XHI_IPIER_OFFSET,
+                            XHI_IPIXR_WEMPTY_MASK);
+    } else if (pending & XHI_IPIXR_WEMPTY_MASK) {
+        fifo_icap_disable_interrupts(drvdata);
+        complete(&drvdata->write_done);
+    }
+
+    return IRQ_HANDLED;
+}
+
+/**
+ * fifo_icap_set_configuration_irq - Send configuration data with interrupts.
+ * @drvdata: a pointer to the drvdata.
+ * @frame_buffer: a pointer to the data to be written to the
+ *        ICAP device.
+ * @num_words: the number of words (32 bit) to write to the ICAP
+ *        device.
+ * @deadline: end of the transfer.
+ *
+ * The write FIFO is filled up to its depth, the rest of the data is written
+ * by fifo_icap_irq_thread while this thread sleeps. The interrupts are
+ * enabled before the transfer is started, so a FIFO that drains quickly
+ * can't latch its interrupts before the pending bits are cleared.
+ **/
+static int fifo_icap_set_configuration_irq(struct hwicap_drvdata *drvdata,
+        const u32 *frame_buffer, u32 num_words, ktime_t deadline)
+{
+    u32 words_to_write = min(drvdata->wf_depth, num_words);
+    ktime_t now;
+    int status = 0;
+
+    drvdata->irq_data = frame_buffer + words_to_write;
+    drvdata->irq_words = num_words - words_to_write;
+    reinit_completion(&drvdata->write_done);
+
+    fifo_icap_fifo_write(drvdata, frame_buffer, words_to_write);
+
+    /*
+     * The FIFO only drains after the start, so no event that the handler
+     * needs is cleared with the stale ones. The handler also updates the
+     * shadowed IPIER and GIER, it is kept out until they are written.
+     */
+    disable_irq(drvdata->irq);
+    fifo_icap_enable_interrupts(drvdata,
+            XHI_IPIXR_WRP_MASK | XHI_IPIXR_WEMPTY_MASK);
+    enable_irq(drvdata->irq);
+
+    fifo_icap_start_config(drvdata);
+
+    now = ktime_get();
+    if (!ktime_before(now, deadline) ||
+        !wait_for_completion_timeout(&drvdata->write_done,
+                nsecs_to_jiffies(ktime_to_ns(ktime_sub(deadline, now))))) {
+        /* Stop the handler before the interrupts are disabled. */
+        disable_irq(drvdata->irq);
+        fifo_icap_disable_interrupts(drvdata);
+        if (drvdata->irq_words > 0)
+            status = -EIO;
+        drvdata->irq_words = 0;
+        enable_irq(drvdata->irq);
+    }
+
+    return status;
 }
 
 /**
@@ -166,13 +339,23 @@ static inline u32 fifo_icap_read_fifo_occupancy(
  * This function writes the given user data to the Write FIFO in
  * polled mode and starts the transfer of the data to
  * the ICAP device.
+ *
+ * The ICAP is idle when the call starts, so the write FIFO is empty and
+ * can take wf_depth words. The vacancy register is only read when this
+ * credit is used up. If the device has an interrupt, transfers that don't
+ * fit into the FIFO are refilled by the interrupt handler instead.
+ *
+ * Returns -ETIMEDOUT if the ICAP is not done within the time budget. The
+ * device is reset after a failed transfer, so the write FIFO is empty again.
  **/
 int fifo_icap_set_configuration(struct hwicap_drvdata *drvdata,
-        u32 *frame_buffer, u32 num_words)
+        const u32 *frame_buffer, u32 num_words)
 {
-    u32 write_fifo_vacancy = 0;
-    u32 retries = 0;
+    u32 write_fifo_vacancy;
     u32 remaining_words;
+    u32 words_to_write;
+    ktime_t deadline;
+    int status;
 
     /*
      * Check if the ICAP device is Busy with the last Read/Write
@@ -180,44 +363,60 @@ int fifo_icap_set_configuration(struct hwicap_drvdata *drvdata,
     if (fifo_icap_busy(drvdata))
         return -EBUSY;
 
+    /*
+     * The whole call is limited by the time the ICAP needs for the words.
+     */
+    deadline = ktime_add_ns(ktime_get(), icap_wait_budget_ns((u64) num_words * 4,
+                            drvdata->icap_clock_hz, drvdata->icap_width));
+
+    if (drvdata->irq > 0 && num_words > drvdata->wf_depth) {
+        if (fifo_icap_set_configuration_irq(drvdata, frame_buffer,
+                                            num_words, deadline)) {
+            status = -EIO;
+            goto failed;
+        }
+
+        remaining_words = 0;
+        goto wait_done;
+    }
+
     /*
      * Set up the buffer pointer and the words to be transferred.
      */
     remaining_words = num_words;
+    write_fifo_vacancy = drvdata->wf_depth;
 
     while (remaining_words > 0) {
         /*
-         * Wait until we have some data in the fifo.
+         * Wait until we have some space in the fifo.
          */
-        while (write_fifo_vacancy == 0) {
-            write_fifo_vacancy =
-                fifo_icap_write_fifo_vacancy(drvdata);
-            retries++;
-            if (retries > XHI_MAX_RETRIES)
-                return -EIO;
+        if (write_fifo_vacancy == 0 &&
+            icap_reg_poll(&drvdata->regs, XHI_WFV_OFFSET, ~0U,
+                          deadline, &write_fifo_vacancy)) {
+            status = -EIO;
+            goto failed;
         }
 
         /*
          * Write data into the Write FIFO.
          */
-        while ((write_fifo_vacancy != 0) &&
-                (remaining_words > 0)) {
-            fifo_icap_fifo_write(drvdata, *frame_buffer);
+        words_to_write = min(write_fifo_vacancy, remaining_words);
+        fifo_icap_fifo_write(drvdata, frame_buffer, words_to_write);
+
+        remaining_words -= words_to_write;
+        write_fifo_vacancy -= words_to_write;
+        frame_buffer += words_to_write;
 
-            remaining_words--;
-            write_fifo_vacancy--;
-            frame_buffer++;
-        }
         /* Start pushing whatever is in the FIFO into the ICAP. */
         fifo_icap_start_config(drvdata);
     }
 
+wait_done:
     /* Wait until the write has finished. */
-    while (fifo_icap_busy(drvdata)) {
-        retries++;
-        if (retries > XHI_MAX_RETRIES)
-            break;
-    }
+    status = icap_reg_poll(&drvdata->regs, XHI_SR_OFFSET, XHI_SR_DONE_MASK,
+                           deadline, NULL);
+    if (status)
+        goto failed;
 
     /*
      * If the requested number of words have not been read from
@@ -227,6 +426,13 @@ int fifo_icap_set_configuration(struct hwicap_drvdata *drvdata,
         return -EIO;
 
     return 0;
+
+failed:
+    /*
+     * Words are left in the write FIFO, the next call expects it empty.
+     */
+    fifo_icap_reset(drvdata);
+    return status;
 }
 
 /**
@@ -242,10 +448,10 @@ int fifo_icap_get_configuration(struct hwicap_drvdata *drvdata,
         u32 *frame_buffer, u32 num_words)
 {
     u32 read_fifo_occupancy = 0;
-    u32 retries = 0;
     u32 *data = frame_buffer;
     u32 remaining_words;
     u32 words_to_read;
+    ktime_t deadline;
 
     /*
      * Check if the ICAP device is Busy with the last Write/Read
@@ -253,6 +459,12 @@ int fifo_icap_get_configuration(struct hwicap_drvdata *drvdata,
     if (fifo_icap_busy(drvdata))
         return -EBUSY;
 
+    /*
+     * The whole call is limited by the time the ICAP needs for the words.
+     */
+    deadline = ktime_add_ns(ktime_get(), icap_wait_budget_ns((u64) num_words * 4,
+                            drvdata->icap_clock_hz, drvdata->icap_width));
+
     remaining_words = num_words;
 
     while (remaining_words > 0) {
@@ -269,13 +481,10 @@ int fifo_icap_get_configuration(struct hwicap_drvdata *drvdata,
 
         while (words_to_read > 0) {
             /* Wait until we have some data in the fifo. */
-            while (read_fifo_occupancy == 0) {
-                read_fifo_occupancy =
-                    fifo_icap_read_fifo_occupancy(drvdata);
-                retries++;
-                if (retries > XHI_MAX_RETRIES)
-                    return -EIO;
-            }
+            if (read_fifo_occupancy == 0 &&
+                icap_reg_poll(&drvdata->regs, XHI_RFO_OFFSET, ~0U,
+                              deadline, &read_fifo_occupancy))
+                return -EIO;
 
             if (read_fifo_occupancy > words_to_read)
                 read_fifo_occupancy = words_to_read;
@@ -283,10 +492,9 @@ int fifo_icap_get_configuration(struct hwicap_drvdata *drvdata,
             words_to_read -= read_fifo_occupancy;
 
             /* Read the data from the Read FIFO. */
-            while (read_fifo_occupancy != 0) {
-                *data++ = fifo_icap_fifo_read(drvdata);
-                read_fifo_occupancy--;
-            }
+            fifo_icap_fifo_read(drvdata, data, read_fifo_occupancy);
+            data += read_fifo_occupancy;
+            read_fifo_occupancy = 0;
         }
     }
 
@@ -306,15 +514,27 @@ void fifo_icap_reset(struct hwicap_drvdata *drvdata)
     u32 reg_data;
     /*
      * Reset the device by setting/clearing the RESET bit in the
-     * Control Register.
+     * Control Register. The control register is shadowed, so only the
+     * first reset reads it.
      */
-    reg_data = ioread32le(drvdata->base_address + XHI_CR_OFFSET);
+    reg_data = icap_reg_read(&drvdata->regs, XHI_CR_OFFSET);
+
+    icap_reg_write_relaxed(&drvdata->regs, XHI_CR_OFFSET,
+                           reg_data | XHI_CR_SW_RESET_MASK);
+
+    icap_reg_write_relaxed(&drvdata->regs, XHI_CR_OFFSET,
+                           reg_data & (~XHI_CR_SW_RESET_MASK));
 
-    iowrite32le(reg_data | XHI_CR_SW_RESET_MASK,
-                drvdata->base_address + XHI_CR_OFFSET);
+    /* The interrupt enable registers returned to their reset values. */
+    icap_regs_set_shadow(&drvdata->regs, XHI_GIER_OFFSET, 0);
+    icap_regs_set_shadow(&drvdata->regs, XHI_IPIER_OFFSET, 0);
 
-    iowrite32le(reg_data & (~XHI_CR_SW_RESET_MASK),
-                drvdata->base_address + XHI_CR_OFFSET);
+    /*
+     * The write FIFO is empty now, so its vacancy is the depth of the FIFO.
+     * The depth is a parameter of the IP and only read after the first reset.
+     */
+    if (drvdata->wf_depth == 0)
+        drvdata->wf_depth = fifo_icap_write_fifo_vacancy(drvdata);
 }
 
 /**
@@ -328,12 +548,12 @@ void fifo_icap_flush_fifo(struct hwicap_drvdata *drvdata)
      * Flush the FIFO by setting/clearing the FIFO Clear bit in the
      * Control Register.
      */
-    reg_data = ioread32le(drvdata->base_address + XHI_CR_OFFSET);
+    reg_data = icap_reg_read(&drvdata->regs, XHI_CR_OFFSET);
 
-    iowrite32le(reg_data | XHI_CR_FIFO_CLR_MASK,
-                drvdata->base_address + XHI_CR_OFFSET);
+    icap_reg_write_relaxed(&drvdata->regs, XHI_CR_OFFSET,
+                           reg_data | XHI_CR_FIFO_CLR_MASK);
 
-    iowrite32le(reg_data & (~XHI_CR_FIFO_CLR_MASK),
-                drvdata->base_address + XHI_CR_OFFSET);
+    icap_reg_write_relaxed(&drvdata->regs, XHI_CR_OFFSET,
+                           reg_data & (~XHI_CR_FIFO_CLR_MASK));
 }
 
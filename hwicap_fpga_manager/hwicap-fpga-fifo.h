@@ -4,13 +4,11 @@
 #include <linux/types.h>
 #include <linux/cdev.h>
 #include <linux/platform_device.h>
+#include <linux/interrupt.h>
 
 #include <asm/io.h>
 #include "hwicap-fpga.h"
 
-#define iowrite32le(v,p) ({ __iowmb(); __raw_writel((__force __u32) cpu_to_le32(v), p); })
-#define ioread32le(p)    ({ __u32 __v = le32_to_cpu((__force __le32)__raw_readl(p)); __iormb(__v); __v; })
-
 /* Reads integers from the device into the storage buffer. */
 int fifo_icap_get_configuration(
         struct hwicap_drvdata *drvdata,
@@ -20,11 +18,14 @@ int fifo_icap_get_configuration(
 /* Writes integers to the device from the storage buffer. */
 int fifo_icap_set_configuration(
         struct hwicap_drvdata *drvdata,
-        u32 *FrameBuffer,
+        const u32 *FrameBuffer,
         u32 NumWords);
 
+void fifo_icap_regs_init(struct hwicap_drvdata *drvdata);
 u32 fifo_icap_get_status(struct hwicap_drvdata *drvdata);
 void fifo_icap_reset(struct hwicap_drvdata *drvdata);
 void fifo_icap_flush_fifo(struct hwicap_drvdata *drvdata);
+void fifo_icap_disable_interrupts(struct hwicap_drvdata *drvdata);
+irqreturn_t fifo_icap_irq_thread(int irq, void *dev_id);
 
 #endif
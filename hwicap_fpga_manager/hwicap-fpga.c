@@ -14,13 +14,31 @@
 #include <linux/fpga/fpga-mgr.h>
 #include <linux/firmware/xlnx-zynqmp.h>
 #include <linux/slab.h>
+#include <linux/scatterlist.h>
 
 #include "hwicap-fpga.h"
 #include "hwicap-fpga-fifo.h"
+#include "hwicap-readback.h"
+#include "hwicap-delta.h"
 
 #define DRIVER_NAME "hwicap_fpga_manager"
 #define UNIMPLEMENTED 0xFFFF
 
+static bool check_crc;
+module_param(check_crc, bool, 0644);
+MODULE_PARM_DESC(check_crc,
+    "Check the configuration CRC of unencrypted bitstreams while they are written (default false)");
+
+static bool verify_load;
+module_param(verify_load, bool, 0644);
+MODULE_PARM_DESC(verify_load,
+    "Check the STAT register of the ICAP for CRC, IDCODE and decryption errors after each load (default false)");
+
+static bool delta_load;
+module_param(delta_load, bool, 0644);
+MODULE_PARM_DESC(delta_load,
+    "Only write the frame bursts that differ from the last bitstream loaded into the region (default false)");
+
 
 // config registers are based on virtex 6 in the original driver
 static const struct config_registers zynq_usp_config_registers = {
@@ -93,7 +111,7 @@ struct hwicap_fpga_priv {
  * bitstream containing a NULL packet, followed by a SYNCH packet is
  * required before the ICAP will recognize commands.
  */
-static int hwicap_command_desync(struct hwicap_drvdata *drvdata)
+int hwicap_command_desync(struct hwicap_drvdata *drvdata)
 {
     u32 buffer[4];
     u32 index = 0;
@@ -116,24 +134,29 @@ static int hwicap_command_desync(struct hwicap_drvdata *drvdata)
 
 
 /**
- * hwicap_get_configuration_register - Query a configuration register.
+ * hwicap_get_configuration_registers - Query several configuration registers.
  * @drvdata: a pointer to the drvdata.
- * @reg: a constant which represents the configuration
- * register value to be returned.
- * Examples: XHI_IDCODE, XHI_FLR.
- * @reg_data: returns the value of the register.
+ * @regs: constants which represent the configuration registers to be
+ * returned, e.g. drvdata->config_regs->STAT.
+ * @count: the number of registers, at most HWICAP_MAX_QUERY_REGS.
+ * @reg_data: returns the values of the registers.
  *
  * Returns: '0' on success and failure value on error
  *
- * Sends a query packet to the ICAP and then receives the response.
+ * Sends the sync and the query packets of all registers to the ICAP in one
+ * transaction and then receives all responses in one readback.
  * The icap is left in Synched state.
  */
-static int hwicap_get_configuration_register(struct hwicap_drvdata *drvdata,
-        u32 reg, u32 *reg_data)
+int hwicap_get_configuration_registers(struct hwicap_drvdata *drvdata,
+        const u32 *regs, u32 count, u32 *reg_data)
 {
     int status;
-    u32 buffer[6];
+    u32 buffer[5 + 3 * HWICAP_MAX_QUERY_REGS];
     u32 index = 0;
+    u32 i;
+
+    if (count == 0 || count > HWICAP_MAX_QUERY_REGS)
+        return -EINVAL;
 
     /*
      * Create the data to be written to the ICAP.
@@ -144,6 +167,12 @@ static int hwicap_get_configuration_register(struct hwicap_drvdata *drvdata,
     buffer[index++] = XHI_NOOP_PACKET;
     buffer[index++] = XHI_NOOP_PACKET;
 
+    for (i = 0; i < count; i++) {
+        buffer[index++] = hwicap_type_1_read(regs[i]) | 1;
+        buffer[index++] = XHI_NOOP_PACKET;
+        buffer[index++] = XHI_NOOP_PACKET;
+    }
+
     /*
      * Write the data to the FIFO and initiate the transfer of data present
      * in the FIFO to the ICAP device.
@@ -153,28 +182,77 @@ static int hwicap_get_configuration_register(struct hwicap_drvdata *drvdata,
     if (status)
         return status;
 
+    /*
+     * Read the configuration registers, one word each.
+     */
+    return drvdata->config->get_configuration(drvdata, reg_data, count);
+}
 
-    index = 0;
-    buffer[index++] = hwicap_type_1_read(reg) | 1;
-    buffer[index++] = XHI_NOOP_PACKET;
-    buffer[index++] = XHI_NOOP_PACKET;
 
-    /*
-     * Write the data to the FIFO and intiate the transfer of data present
-     * in the FIFO to the ICAP device.
+/**
+ * hwicap_get_configuration_register - Query a configuration register.
+ * @drvdata: a pointer to the drvdata.
+ * @reg: a constant which represents the configuration
+ * register value to be returned.
+ * Examples: XHI_IDCODE, XHI_FLR.
+ * @reg_data: returns the value of the register.
+ *
+ * Returns: '0' on success and failure value on error
+ *
+ * The icap is left in Synched state.
+ */
+static int hwicap_get_configuration_register(struct hwicap_drvdata *drvdata,
+        u32 reg, u32 *reg_data)
+{
+    return hwicap_get_configuration_registers(drvdata, &reg, 1, reg_data);
+}
+
+
+/**
+ * hwicap_icap_handshake - Bring the ICAP into a known state.
+ * @dev: device used for messages.
+ * @drvdata: a pointer to the drvdata.
+ *
+ * Returns: '0' on success and failure value on error
+ *
+ * Any current transaction is aborted, then the ICAP is desynced, the IDCODE
+ * is read and the ICAP is desynced again. On success the ICAP is idle.
+ */
+static int hwicap_icap_handshake(struct device *dev,
+        struct hwicap_drvdata *drvdata)
+{
+    int status;
+
+    drvdata->icap_idle = false;
+
+    /* Abort any current transaction, to make sure we have the
+     * ICAP in a good state.
      */
-    status = drvdata->config->set_configuration(drvdata,
-            &buffer[0], index);
+    dev_dbg(dev, "Reset...\n");
+    drvdata->config->reset(drvdata);
+
+    dev_dbg(dev, "Desync...\n");
+    status = hwicap_command_desync(drvdata);
     if (status)
         return status;
 
-    /*
-     * Read the configuration register
+    /* Attempt to read the IDCODE from ICAP.  This
+     * may not be returned correctly, due to the design of the
+     * hardware.
      */
-    status = drvdata->config->get_configuration(drvdata, reg_data, 1);
+    dev_dbg(dev, "Reading IDCODE...\n");
+    status = hwicap_get_configuration_register(
+            drvdata, drvdata->config_regs->IDCODE, &drvdata->idcode);
+    if (status)
+        return status;
+    dev_dbg(dev, "IDCODE = %x\n", drvdata->idcode);
+
+    dev_dbg(dev, "Desync...\n");
+    status = hwicap_command_desync(drvdata);
     if (status)
         return status;
 
+    drvdata->icap_idle = true;
     return 0;
 }
 
@@ -233,18 +311,64 @@ static int hwicap_setup(struct device *dev, struct hwicap_fpga_priv *priv)
 
     drvdata->config = config;
     drvdata->config_regs = config_regs;
+    fifo_icap_regs_init(drvdata);
+
+    /* The ICAP clock and width limit the time budget of all waits. */
+    drvdata->icap_clock_hz = ICAP_DEFAULT_CLOCK_HZ;
+    drvdata->icap_width = ICAP_DEFAULT_WIDTH;
+    of_property_read_u32(dev->of_node, "xlnx,icap-clock-frequency",
+                         &drvdata->icap_clock_hz);
+    of_property_read_u32(dev->of_node, "xlnx,icap-width",
+                         &drvdata->icap_width);
+    if (!drvdata->icap_clock_hz || (drvdata->icap_width != 8 &&
+        drvdata->icap_width != 16 && drvdata->icap_width != 32)) {
+        dev_err(dev, "Invalid ICAP clock or width in device tree\n");
+        retval = -EINVAL;
+        goto failed3;
+    }
 
     mutex_init(&drvdata->sem);
+    init_completion(&drvdata->write_done);
+
+    /*
+     * The write FIFO is refilled by the interrupt if it is wired. The
+     * reset disables the interrupts of the device and reads the depth of
+     * the write FIFO, which the interrupt mode needs.
+     */
+    drvdata->irq = platform_get_irq_optional(to_platform_device(dev), 0);
+    if (drvdata->irq > 0) {
+        fifo_icap_reset(drvdata);
+        retval = devm_request_threaded_irq(dev, drvdata->irq, NULL,
+                                           fifo_icap_irq_thread, IRQF_ONESHOT,
+                                           DRIVER_NAME, drvdata);
+        if (retval) {
+            dev_err(dev, "Couldn't request HWICAP interrupt %d\n", drvdata->irq);
+            goto failed3;
+        }
+    }
+
+    dev_info(dev, "HWICAP write FIFO refilled by %s\n",
+             drvdata->irq > 0 ? "interrupt" : "polling");
+
+    /*
+     * The IDCODE is read once here. If the handshake fails, it is
+     * repeated by the first load.
+     */
+    if (hwicap_icap_handshake(dev, drvdata))
+        dev_warn(dev, "Couldn't read the IDCODE of the ICAP\n");
+    else
+        dev_info(dev, "ICAP IDCODE %08x\n", drvdata->idcode);
 
     priv->drvdata = drvdata;
     return 0;    /* success */
 
- failed2:
+ failed3:
     iounmap(drvdata->base_address);
 
- failed1:
+ failed2:
     release_mem_region(res.start, drvdata->mem_size);
 
+ failed1:
  failed0:
     kfree(drvdata);
 
@@ -276,8 +400,9 @@ static int hwicap_fpga_ops_write_init(struct fpga_manager *mgr,
     struct hwicap_fpga_priv *priv;
     int eemi_flags = 0;
     int status;
-    u32 idcode;
     struct hwicap_drvdata *drvdata;
+    const u8 *header;
+    ssize_t len;
 
     mgr->state = FPGA_MGR_STATE_WRITE_INIT;
 
@@ -306,46 +431,280 @@ static int hwicap_fpga_ops_write_init(struct fpga_manager *mgr,
         return -EINVAL;
     }
 
-    // HWICAP Initialising
-    dev_dbg(&mgr->dev, "Initializing HWICAP...\n");
-
-    /* Abort any current transaction, to make sure we have the
-     * ICAP in a good state.
-     */
-    dev_dbg(&mgr->dev, "Reset...\n");
-    drvdata->config->reset(drvdata);
-
-    dev_dbg(&mgr->dev, "Desync...\n");
-    status = hwicap_command_desync(drvdata);
+    /* The setup of the load changes the state shared with the readback. */
+    status = mutex_lock_interruptible(&drvdata->sem);
     if (status) {
         mgr->state = FPGA_MGR_STATE_WRITE_INIT_ERR;
         return status;
     }
 
-    /* Attempt to read the IDCODE from ICAP.  This
-     * may not be returned correctly, due to the design of the
-     * hardware.
+    /* A running readback owns the HWICAP until its file is closed. */
+    if (drvdata->readback_active) {
+        dev_err(&mgr->dev, "Readback in progress, can't load a bitstream\n");
+        status = -EBUSY;
+        goto failed_unlock;
+    }
+
+    /* Compressed bitstreams are parsed from their decompressed start. */
+    icap_unzstd_free(&drvdata->unzstd);
+    header = (const u8 *)buf;
+    if (icap_unzstd_detect(header, size)) {
+        status = icap_unzstd_init(&drvdata->unzstd, header, size);
+        if (!status) {
+            len = icap_unzstd_peek(&drvdata->unzstd, header, size,
+                    drvdata->stage_buffer, sizeof(drvdata->stage_buffer));
+            status = (len < 0) ? len : 0;
+        }
+        if (status) {
+            dev_err(&mgr->dev, "Can't decompress the bitstream (%d)\n", status);
+            goto failed_free;
+        }
+        dev_dbg(&mgr->dev, "zstd compressed bitstream, %llu bytes\n",
+                drvdata->unzstd.size);
+
+        header = (const u8 *)drvdata->stage_buffer;
+        size = len;
+    }
+
+    /* Find the sync word and the byte order of .bit and .bin files. */
+    if (icap_bitstream_parse(header, size, &drvdata->skip_bytes,
+                             &drvdata->swap)) {
+        dev_err(&mgr->dev, "No sync word in the .bit file\n");
+        status = -EINVAL;
+        goto failed_free;
+    }
+    dev_dbg(&mgr->dev, "Sync word at %zu, swap %d\n",
+            drvdata->skip_bytes, drvdata->swap);
+
+    // HWICAP Initialising
+    dev_dbg(&mgr->dev, "Initializing HWICAP...\n");
+
+    /* Count the register accesses of this load. */
+    icap_regs_reset_stats(&drvdata->regs);
+
+    /* Drop the incomplete word of an aborted load. */
+    drvdata->write_buffer_in_use = 0;
+
+    /* The CRC of encrypted bitstreams is computed over the decrypted data.
+     * The packets are always parsed to find the DESYNC at the end.
      */
-    dev_dbg(&mgr->dev, "Reading IDCODE...\n");
-    status = hwicap_get_configuration_register(
-            drvdata, drvdata->config_regs->IDCODE, &idcode);
-    if (status) {
-        mgr->state = FPGA_MGR_STATE_WRITE_INIT_ERR;
-        return status;
+    drvdata->crc_check = check_crc && !(priv->flags &
+            (FPGA_MGR_ENCRYPTED_BITSTREAM | FPGA_MGR_USERKEY_ENCRYPTED_BITSTREAM));
+    icap_crc_init(&drvdata->crc, drvdata->config_regs, drvdata->crc_check);
+
+    /* The frames of encrypted and compressed bitstreams can't be compared. */
+    hwicap_delta_begin(drvdata->delta, delta_load && !drvdata->unzstd.stream &&
+            !(priv->flags & (FPGA_MGR_ENCRYPTED_BITSTREAM |
+                             FPGA_MGR_USERKEY_ENCRYPTED_BITSTREAM)),
+            drvdata->skip_bytes, drvdata->swap);
+
+    /* The ICAP is only known to be idle and desynced after a complete
+     * load, otherwise the handshake brings it into a good state.
+     */
+    if (drvdata->icap_idle) {
+        dev_dbg(&mgr->dev, "ICAP idle, skipping the handshake\n");
+    } else {
+        status = hwicap_icap_handshake(&mgr->dev, drvdata);
+        if (status)
+            goto failed_free;
     }
-    dev_dbg(&mgr->dev, "IDCODE = %x\n", idcode);
 
-    dev_dbg(&mgr->dev, "Desync...\n");
-    status = hwicap_command_desync(drvdata);
-    if (status) {
-        mgr->state = FPGA_MGR_STATE_WRITE_INIT_ERR;
+    /* Until the load is complete, the state of the ICAP is unknown. */
+    drvdata->icap_idle = false;
+
+    /* Readbacks can't start until the load is complete or failed. */
+    drvdata->load_active = true;
+    mutex_unlock(&drvdata->sem);
+
+    return 0;
+
+failed_free:
+    icap_unzstd_free(&drvdata->unzstd);
+failed_unlock:
+    mutex_unlock(&drvdata->sem);
+    mgr->state = FPGA_MGR_STATE_WRITE_INIT_ERR;
+    return status;
+}
+
+
+/**
+ * hwicap_write_words - Send whole words of the bitstream to the ICAP.
+ * @drvdata: a pointer to the drvdata.
+ * @data: the words
+ * @num_words: the number of words
+ *
+ * Returns: '0' on success and failure value on error
+ *
+ * The words are parsed before they are written, which tells whether the
+ * bitstream ends with a DESYNC. If the CRC is checked, none of them is
+ * written if they contain a CRC packet that does not match. In a
+ * differential load, the bursts that did not change are dropped.
+ */
+static int hwicap_write_words(struct hwicap_drvdata *drvdata,
+        const u32 *data, u32 num_words)
+{
+    int status;
+
+    status = icap_crc_update(&drvdata->crc, data, num_words);
+    if (status)
         return status;
+
+    if (hwicap_delta_active(drvdata->delta))
+        return hwicap_delta_write(drvdata, data, num_words);
+
+    return drvdata->config->set_configuration(drvdata, data, num_words);
+}
+
+
+/**
+ * hwicap_write_data - Send a part of the bitstream to the ICAP.
+ * @drvdata: a pointer to the drvdata.
+ * @data: the part of the bitstream
+ * @size: size of data in bytes
+ *
+ * Returns: '0' on success and failure value on error
+ *
+ * The parts of a bitstream don't have to end on a word boundary. The bytes
+ * of an incomplete word are kept in write_buffer and completed by the next
+ * part. Whole words are written straight from data, only the word that
+ * completes write_buffer and data that is not 32 bit aligned in memory go
+ * through the stage buffer of the device. Bitstreams that are not in the
+ * word order of the ICAP are converted in the stage buffer. The header
+ * found by write_init is dropped.
+ */
+static int hwicap_write_data(struct hwicap_drvdata *drvdata,
+        const u8 *data, size_t size)
+{
+    size_t len;
+    u32 words;
+    int status;
+
+    /* Drop the .bit header and the words before the sync word. */
+    len = min(drvdata->skip_bytes, size);
+    drvdata->skip_bytes -= len;
+    data += len;
+    size -= len;
+
+    /* Complete the word started by the last part. */
+    if (drvdata->write_buffer_in_use) {
+        len = min_t(size_t, 4 - drvdata->write_buffer_in_use, size);
+        memcpy(drvdata->write_buffer + drvdata->write_buffer_in_use,
+               data, len);
+        drvdata->write_buffer_in_use += len;
+        data += len;
+        size -= len;
+
+        if (drvdata->write_buffer_in_use < 4)
+            return 0;
+
+        memcpy(drvdata->stage_buffer, drvdata->write_buffer, 4);
+        icap_swap_words(drvdata->stage_buffer, 1, drvdata->swap);
+        drvdata->write_buffer_in_use = 0;
+
+        status = hwicap_write_words(drvdata,
+                drvdata->stage_buffer, 1);
+        if (status)
+            return status;
+    }
+
+    while (size > 3) {
+        if (IS_ALIGNED((unsigned long)data, 4) &&
+            drvdata->swap == ICAP_SWAP_NONE) {
+            words = min_t(size_t, size >> 2, U32_MAX);
+            status = hwicap_write_words(drvdata,
+                    (const u32 *)data, words);
+        } else {
+            words = min_t(size_t, size >> 2, HWICAP_STAGE_WORDS);
+            memcpy(drvdata->stage_buffer, data, words << 2);
+            icap_swap_words(drvdata->stage_buffer, words, drvdata->swap);
+            status = hwicap_write_words(drvdata,
+                    drvdata->stage_buffer, words);
+        }
+        if (status)
+            return status;
+
+        data += words << 2;
+        size -= words << 2;
     }
 
+    /* Keep the bytes of an incomplete word for the next part. */
+    memcpy(drvdata->write_buffer, data, size);
+    drvdata->write_buffer_in_use = size;
+
+    return 0;
+}
+
+
+/**
+ * hwicap_write_part - Write a part of the bitstream given to the write ops
+ * @drvdata: a pointer to the drvdata.
+ * @data: the part of the bitstream.
+ * @size: the size of the part in bytes.
+ *
+ * Compressed bitstreams are decompressed into unpack_buffer, one buffer at a
+ * time, and written from there like an uncompressed part. Returns -EINVAL if
+ * the compressed data is corrupt.
+ */
+static int hwicap_write_part(struct hwicap_drvdata *drvdata,
+        const u8 *data, size_t size)
+{
+    ssize_t len;
+    int status;
+
+    if (!drvdata->unzstd.stream)
+        return hwicap_write_data(drvdata, data, size);
+
+    do {
+        len = icap_unzstd_read(&drvdata->unzstd, &data, &size,
+                drvdata->unpack_buffer, sizeof(drvdata->unpack_buffer));
+        if (len < 0)
+            return len;
+
+        status = hwicap_write_data(drvdata,
+                (const u8 *)drvdata->unpack_buffer, len);
+        if (status)
+            return status;
+    } while (len == sizeof(drvdata->unpack_buffer));
+
     return 0;
 }
 
 
+/**
+ * hwicap_load_end - End a load that failed before write_complete
+ * @drvdata: a pointer to the drvdata.
+ *
+ * Used where a write op could not take the mutex, so readbacks are not
+ * refused after the load.
+ */
+static void hwicap_load_end(struct hwicap_drvdata *drvdata)
+{
+    mutex_lock(&drvdata->sem);
+    drvdata->load_active = false;
+    mutex_unlock(&drvdata->sem);
+}
+
+
+/**
+ * hwicap_delta_report - Finish the scan of a differential load
+ * @mgr: fpga_manager struct
+ * @drvdata: a pointer to the drvdata.
+ */
+static void hwicap_delta_report(struct fpga_manager *mgr,
+        struct hwicap_drvdata *drvdata)
+{
+    u32 bursts;
+    int dropped;
+
+    dropped = hwicap_delta_prepare(drvdata->delta, &bursts);
+    if (dropped < 0)
+        dev_dbg(&mgr->dev, "No differential load, the bitstream is written as it is\n");
+    else
+        dev_dbg(&mgr->dev, "Differential load, %d of %u bursts unchanged\n",
+                dropped, bursts);
+}
+
+
 /** function hwicap_fpga_ops_write - write count bytes of configuration data to the FPGA
 * @mgr:   fpga_manager struct
 * @buf:   contiguous buffer containing FPGA image
@@ -357,11 +716,7 @@ static int hwicap_fpga_ops_write(struct fpga_manager *mgr,
 {
     struct hwicap_fpga_priv *priv;
     struct hwicap_drvdata *drvdata;
-    ssize_t written = 0;
-    ssize_t left;
-    u32 *kbuf;
-    ssize_t len;
-    ssize_t status;
+    int status;
 
     mgr->state = FPGA_MGR_STATE_WRITE;
 
@@ -370,77 +725,87 @@ static int hwicap_fpga_ops_write(struct fpga_manager *mgr,
 
     status = mutex_lock_interruptible(&drvdata->sem);
     if (status) {
+        hwicap_load_end(drvdata);
         mgr->state = FPGA_MGR_STATE_WRITE_ERR;
-        goto error;
+        return status;
     }
 
-    left = size;
-    left += drvdata->write_buffer_in_use;
-
-    /* Only write multiples of 4 bytes. */
-    if (left < 4) {
-        status = -EINVAL;
-        mgr->state = FPGA_MGR_STATE_WRITE_ERR;
-        goto error;
+    /* A differential load needs the whole bitstream in the first part. */
+    if (hwicap_delta_scanning(drvdata->delta)) {
+        hwicap_delta_scan(drvdata->delta, (const u8 *)buf, size);
+        hwicap_delta_report(mgr, drvdata);
     }
 
-    kbuf = (u32 *) __get_free_page(GFP_KERNEL);
-    if (!kbuf) {
-        status = -ENOMEM;
+    status = hwicap_write_part(drvdata, (const u8 *)buf, size);
+    if (status == -EBADMSG)
+        dev_err(&mgr->dev, "Configuration CRC of the bitstream does not match\n");
+    if (status == -EINVAL)
+        dev_err(&mgr->dev, "Compressed bitstream is corrupt\n");
+    if (status) {
+        if (status != -EBADMSG && status != -EINVAL)
+            status = -EFAULT;
+        drvdata->load_active = false;
         mgr->state = FPGA_MGR_STATE_WRITE_ERR;
-        goto error;
     }
 
-    while (left > 3) {
-        /* only write multiples of 4 bytes, so there might */
-        /* be as many as 3 bytes left (at the end). */
-        len = left;
+    mutex_unlock(&drvdata->sem);
 
-        if (len > PAGE_SIZE)
-            len = PAGE_SIZE;
-        len &= ~3;
+    return status;
+}
 
-        if (drvdata->write_buffer_in_use) {
-            memcpy(kbuf, drvdata->write_buffer, drvdata->write_buffer_in_use);
-            memcpy((((char *)kbuf) + drvdata->write_buffer_in_use),
-                    buf + written, len - (drvdata->write_buffer_in_use));
-        } else {
-            memcpy(kbuf, buf + written, len);
-        }
 
-        status = drvdata->config->set_configuration(drvdata, kbuf, len >> 2);
+/** function hwicap_fpga_ops_write_sg - write a scatter list table of configuration data to the FPGA
+* @mgr:   fpga_manager struct
+* @sgt:   scatter list table containing FPGA image
+* @return 0 if success
+*/
+static int hwicap_fpga_ops_write_sg(struct fpga_manager *mgr,
+                 struct sg_table *sgt)
+{
+    struct hwicap_fpga_priv *priv;
+    struct hwicap_drvdata *drvdata;
+    struct sg_mapping_iter miter;
+    int status;
 
-        if (status) {
-            free_page((unsigned long)kbuf);
-            status = -EFAULT;
-            mgr->state = FPGA_MGR_STATE_WRITE_ERR;
-            goto error;
-        }
-        if (drvdata->write_buffer_in_use) {
-            len -= drvdata->write_buffer_in_use;
-            left -= drvdata->write_buffer_in_use;
-            drvdata->write_buffer_in_use = 0;
-        }
-        written += len;
-        left -= len;
-    }
+    mgr->state = FPGA_MGR_STATE_WRITE;
 
-    // not sure if this really works as intended...
-    if ((left > 0) && (left < 4)) {
-        if (memcpy(drvdata->write_buffer,
-                        buf + written, left)) {
-            drvdata->write_buffer_in_use = left;
-            written += left;
-            left = 0;
-        }
+    priv = mgr->priv;
+    drvdata = priv->drvdata;
+
+    status = mutex_lock_interruptible(&drvdata->sem);
+    if (status) {
+        hwicap_load_end(drvdata);
+        mgr->state = FPGA_MGR_STATE_WRITE_ERR;
+        return status;
     }
 
-    free_page((unsigned long)kbuf);
+    /* The table holds the whole bitstream, it is scanned before it is written. */
+    if (hwicap_delta_scanning(drvdata->delta)) {
+        sg_miter_start(&miter, sgt->sgl, sgt->orig_nents, SG_MITER_FROM_SG);
+        while (sg_miter_next(&miter))
+            hwicap_delta_scan(drvdata->delta, miter.addr, miter.length);
+        sg_miter_stop(&miter);
+        hwicap_delta_report(mgr, drvdata);
+    }
 
-    //check if the whole bitstream was written
-    status = (size - written);
+    /* Every segment is written from where it is, no copy of the table is made. */
+    sg_miter_start(&miter, sgt->sgl, sgt->orig_nents, SG_MITER_FROM_SG);
+    while (sg_miter_next(&miter)) {
+        status = hwicap_write_part(drvdata, miter.addr, miter.length);
+        if (status == -EBADMSG)
+            dev_err(&mgr->dev, "Configuration CRC of the bitstream does not match\n");
+        if (status == -EINVAL)
+            dev_err(&mgr->dev, "Compressed bitstream is corrupt\n");
+        if (status) {
+            if (status != -EBADMSG && status != -EINVAL)
+                status = -EFAULT;
+            drvdata->load_active = false;
+            mgr->state = FPGA_MGR_STATE_WRITE_ERR;
+            break;
+        }
+    }
+    sg_miter_stop(&miter);
 
- error:
     mutex_unlock(&drvdata->sem);
 
     return status;
@@ -454,27 +819,103 @@ static int hwicap_fpga_ops_write(struct fpga_manager *mgr,
 */
 int hwicap_fpga_ops_write_complete(struct fpga_manager *mgr, struct fpga_image_info *info)
 {
+    struct hwicap_fpga_priv *priv = mgr->priv;
+    struct hwicap_drvdata *drvdata = priv->drvdata;
+    const char *error;
+    u64 left;
+    u32 stat;
+    int status;
+
+    dev_dbg(&mgr->dev, "%u register reads and %u register writes\n",
+            drvdata->regs.reads, drvdata->regs.writes);
+
+    /* Readbacks are only possible again after the ICAP is idle. */
+    mutex_lock(&drvdata->sem);
+
+    /* The decoder is not needed anymore, a missing end is an error. */
+    left = drvdata->unzstd.stream ? drvdata->unzstd.left : 0;
+    icap_unzstd_free(&drvdata->unzstd);
+    if (left) {
+        dev_err(&mgr->dev, "Compressed bitstream ends %llu bytes early\n", left);
+        status = -EINVAL;
+        goto failed;
+    }
+
+    if (verify_load) {
+        /* A few words tell whether the ICAP accepted the bitstream. */
+        status = hwicap_get_configuration_register(drvdata,
+                drvdata->config_regs->STAT, &stat);
+        if (!status)
+            status = hwicap_command_desync(drvdata);
+        if (status) {
+            dev_err(&mgr->dev, "Couldn't read the STAT register\n");
+            goto failed;
+        }
+
+        error = icap_stat_error(stat);
+        if (error) {
+            dev_err(&mgr->dev, "ICAP reports a %s (STAT = %08x)\n", error, stat);
+            status = -EIO;
+            goto failed;
+        }
+        dev_dbg(&mgr->dev, "STAT = %x\n", stat);
+    }
+
+    /* If the bitstream or the STAT query ended with a DESYNC, the next load
+     * can skip the handshake.
+     */
+    drvdata->icap_idle = verify_load || drvdata->crc.desynced;
+    if (!drvdata->icap_idle)
+        dev_dbg(&mgr->dev, "Bitstream doesn't end with a DESYNC\n");
+
+    /* The frames of the region now hold the bitstream. */
+    hwicap_delta_commit(drvdata->delta);
+
+    drvdata->load_active = false;
+    mutex_unlock(&drvdata->sem);
+
     // mgr->state = FPGA_MGR_STATE_WRITE_COMPLETE;
     mgr->state = FPGA_MGR_STATE_OPERATING;
     return 0;
+
+failed:
+    drvdata->load_active = false;
+    mutex_unlock(&drvdata->sem);
+    mgr->state = FPGA_MGR_STATE_WRITE_COMPLETE_ERR;
+    return status;
 }
 
 
 /**
 * struct hwicap_fpga_ops - ops for low level fpga manager drivers
+* @initial_header_size: bytes of the bitstream passed to write_init
 * @write_init:     prepare the FPGA to receive configuration data
 * @write:          write count bytes of configuration data to the FPGA
+* @write_sg:       write a scatter list table of configuration data to the FPGA
 * @write_complete: set FPGA to operating state after writing is done
 * @state:          returns an enum value of the FPGA's state
 */
 static const struct fpga_manager_ops hwicap_fpga_ops = {
+    .initial_header_size = ICAP_BITSTREAM_HEADER_SIZE,
     .write_init = hwicap_fpga_ops_write_init,
     .write = hwicap_fpga_ops_write,
+    .write_sg = hwicap_fpga_ops_write_sg,
     .write_complete = hwicap_fpga_ops_write_complete,
     .state = hwicap_fpga_ops_state,
 };
 
 
+/** function hwicap_unzstd_release - free the decoder of an unfinished load
+* @data:  hwicap_drvdata struct
+*/
+static void hwicap_unzstd_release(void *data)
+{
+    struct hwicap_drvdata *drvdata = data;
+
+    icap_unzstd_free(&drvdata->unzstd);
+}
+
+
 /** function hwicap_fpga_probe - probe function
 * @pdev:  platform_device struct
 * @return 0 if success
@@ -510,6 +951,18 @@ static int hwicap_fpga_probe(struct platform_device *pdev)
 
     mgr->state = FPGA_MGR_STATE_OPERATING;
 
+    ret = hwicap_readback_register(dev, priv->drvdata);
+    if (ret)
+        return ret;
+
+    ret = devm_add_action_or_reset(dev, hwicap_unzstd_release, priv->drvdata);
+    if (ret)
+        return ret;
+
+    ret = hwicap_delta_register(dev, priv->drvdata);
+    if (ret)
+        return ret;
+
     return devm_fpga_mgr_register(dev, mgr);
 }
 
@@ -532,7 +985,26 @@ static struct platform_driver hwicap_fpga_driver = {
 };
 
 
-module_platform_driver(hwicap_fpga_driver);
+static int __init hwicap_fpga_init(void)
+{
+    int ret;
+
+    hwicap_readback_debugfs_init();
+
+    ret = platform_driver_register(&hwicap_fpga_driver);
+    if (ret)
+        hwicap_readback_debugfs_exit();
+
+    return ret;
+}
+module_init(hwicap_fpga_init);
+
+static void __exit hwicap_fpga_exit(void)
+{
+    platform_driver_unregister(&hwicap_fpga_driver);
+    hwicap_readback_debugfs_exit();
+}
+module_exit(hwicap_fpga_exit);
 
 MODULE_AUTHOR("KIT-IPE, Hendrik Krause <Hendrik.Krause@kit.edu>");
 MODULE_DESCRIPTION("Xilinx HWICAP FPGA Manager");
@@ -6,14 +6,51 @@
 #include <linux/platform_device.h>
 
 #include <linux/io.h>
+#include <linux/completion.h>
+#include "icap-regs.h"
+#include "icap-packets.h"
+#include "icap-crc.h"
+#include "icap-bitstream.h"
+#include "icap-unzstd.h"
+
+/* Words of the stage buffer for data that is not 32 bit aligned in memory */
+#define HWICAP_STAGE_WORDS 256
+
+struct hwicap_delta;
 
 struct hwicap_drvdata {
     u32 write_buffer_in_use;  /* Always in [0,3] */
     u8 write_buffer[4];
+    size_t skip_bytes;        /* bytes of the bitstream before the sync word still to drop */
+    enum icap_swap swap;      /* conversion of the bitstream into the word order of the ICAP */
+    u32 stage_buffer[HWICAP_STAGE_WORDS]; /* words that are not aligned in the caller's buffer */
+    struct icap_unzstd unzstd; /* decoder of a compressed bitstream */
+    u32 unpack_buffer[HWICAP_STAGE_WORDS]; /* decompressed part of a compressed bitstream */
     resource_size_t mem_start;/* phys. address of the control registers */
     resource_size_t mem_end;  /* phys. address of the control registers */
     resource_size_t mem_size;
     void __iomem *base_address;/* virt. address of the control registers */
+    struct icap_regs regs;    /* access to the control registers */
+    u32 wf_depth;             /* depth of the write FIFO in words */
+    u32 icap_clock_hz;        /* ICAP clock, used for the time budget of the waits */
+    u32 icap_width;           /* ICAP width in bits, used for the time budget of the waits */
+    int irq;                  /* HWICAP interrupt, polling is used if not wired */
+    struct completion write_done; /* interrupt driven transfer finished */
+    const u32 *irq_data;      /* next words of the interrupt driven transfer */
+    u32 irq_words;            /* words of the interrupt driven transfer not in the FIFO yet */
+
+    struct icap_crc crc;      /* CRC check of the current bitstream */
+    bool crc_check;           /* the CRC of the current bitstream is checked */
+
+    u32 idcode;               /* IDCODE read by the last handshake */
+    bool icap_idle;           /* ICAP desynced and HWICAP idle, no handshake needed */
+
+    u32 readback_far;         /* frame address of the next readback */
+    u32 readback_frames;      /* number of frames of the next readback */
+    bool readback_active;     /* a readback owns the HWICAP */
+    bool load_active;         /* a load owns the HWICAP from write_init to write_complete */
+
+    struct hwicap_delta *delta; /* records of the loaded bitstreams for differential loads */
 
     const struct hwicap_driver_config *config;
     const struct config_registers *config_regs;
@@ -29,7 +66,7 @@ struct hwicap_driver_config {
     /* Write configuration data given by size from the data buffer.
      * Return 0 if successful.
      */
-    int (*set_configuration)(struct hwicap_drvdata *drvdata, u32 *data,
+    int (*set_configuration)(struct hwicap_drvdata *drvdata, const u32 *data,
             u32 size);
     /* Get the status register, bit pattern given by:
      * D8 - 0 = configuration error
@@ -47,132 +84,18 @@ struct hwicap_driver_config {
     void (*reset)(struct hwicap_drvdata *drvdata);
 };
 
-/* Number of times to poll the done register. This has to be large
- * enough to allow an entire configuration to complete. If an entire
- * page (4kb) is configured at once, that could take up to 4k cycles
- * with a byte-wide icap interface. In most cases, this driver is
- * used with a much smaller fifo, but this should be sufficient in the
- * worst case.
- */
-#define XHI_MAX_RETRIES     5000
-
-/************ Constant Definitions *************/
-
-#define XHI_PAD_FRAMES              0x1
-
-/* Mask for calculating configuration packet headers */
-#define XHI_WORD_COUNT_MASK_TYPE_1  0x7FFUL
-#define XHI_WORD_COUNT_MASK_TYPE_2  0x1FFFFFUL
-#define XHI_TYPE_MASK               0x7
-#define XHI_REGISTER_MASK           0xF
-#define XHI_OP_MASK                 0x3
-
-#define XHI_TYPE_SHIFT              29
-#define XHI_REGISTER_SHIFT          13
-#define XHI_OP_SHIFT                27
-
-#define XHI_TYPE_1                  1
-#define XHI_TYPE_2                  2
-#define XHI_OP_WRITE                2
-#define XHI_OP_READ                 1
-
-/* Address Block Types */
-#define XHI_FAR_CLB_BLOCK           0
-#define XHI_FAR_BRAM_BLOCK          1
-#define XHI_FAR_BRAM_INT_BLOCK      2
-
-struct config_registers {
-    u32 CRC;
-    u32 FAR;
-    u32 FDRI;
-    u32 FDRO;
-    u32 CMD;
-    u32 CTL;
-    u32 MASK;
-    u32 STAT;
-    u32 LOUT;
-    u32 COR;
-    u32 MFWR;
-    u32 FLR;
-    u32 KEY;
-    u32 CBC;
-    u32 IDCODE;
-    u32 AXSS;
-    u32 C0R_1;
-    u32 CSOB;
-    u32 WBSTAR;
-    u32 TIMER;
-    u32 BOOTSTS;
-    u32 CTL_1;
-};
+/* Send a DESYNC command to the ICAP. */
+int hwicap_command_desync(struct hwicap_drvdata *drvdata);
 
-/* Configuration Commands */
-#define XHI_CMD_NULL                0
-#define XHI_CMD_WCFG                1
-#define XHI_CMD_MFW                 2
-#define XHI_CMD_DGHIGH              3
-#define XHI_CMD_RCFG                4
-#define XHI_CMD_START               5
-#define XHI_CMD_RCAP                6
-#define XHI_CMD_RCRC                7
-#define XHI_CMD_AGHIGH              8
-#define XHI_CMD_SWITCH              9
-#define XHI_CMD_GRESTORE            10
-#define XHI_CMD_SHUTDOWN            11
-#define XHI_CMD_GCAPTURE            12
-#define XHI_CMD_DESYNCH             13
-
-/* Packet constants */
-#define XHI_SYNC_PACKET             0xAA995566UL
-#define XHI_DUMMY_PACKET            0xFFFFFFFFUL
-#define XHI_NOOP_PACKET             (XHI_TYPE_1 << XHI_TYPE_SHIFT)
-#define XHI_TYPE_2_READ ((XHI_TYPE_2 << XHI_TYPE_SHIFT) | \
-            (XHI_OP_READ << XHI_OP_SHIFT))
-
-#define XHI_TYPE_2_WRITE ((XHI_TYPE_2 << XHI_TYPE_SHIFT) | \
-            (XHI_OP_WRITE << XHI_OP_SHIFT))
-
-#define XHI_TYPE2_CNT_MASK          0x07FFFFFF
-
-#define XHI_TYPE_1_PACKET_MAX_WORDS 2047UL
-#define XHI_TYPE_1_HEADER_BYTES     4
-#define XHI_TYPE_2_HEADER_BYTES     8
-
-/* Constant to use for CRC check when CRC has been disabled */
-#define XHI_DISABLED_AUTO_CRC       0x0000DEFCUL
+/* Maximum number of registers of one hwicap_get_configuration_registers call */
+#define HWICAP_MAX_QUERY_REGS 16
+
+/* Query several configuration registers in one transaction, the ICAP is left synched. */
+int hwicap_get_configuration_registers(struct hwicap_drvdata *drvdata,
+        const u32 *regs, u32 count, u32 *reg_data);
 
 /* Meanings of the bits returned by get_status */
 #define XHI_SR_EOS_BIT_MASK 0x00000004 /* EOS Bit Mask */
 #define XHI_SR_DONE_MASK 0x00000001 /* Done bit Mask  */
 
-/**
- * hwicap_type_1_read - Generates a Type 1 read packet header.
- * @reg: is the address of the register to be read back.
- *
- * Return:
- * Generates a Type 1 read packet header, which is used to indirectly
- * read registers in the configuration logic.  This packet must then
- * be sent through the icap device, and a return packet received with
- * the information.
- */
-static inline u32 hwicap_type_1_read(u32 reg)
-{
-    return (XHI_TYPE_1 << XHI_TYPE_SHIFT) |
-        (reg << XHI_REGISTER_SHIFT) |
-        (XHI_OP_READ << XHI_OP_SHIFT);
-}
-
-/**
- * hwicap_type_1_write - Generates a Type 1 write packet header
- * @reg: is the address of the register to be read back.
- *
- * Return: Type 1 write packet header
- */
-static inline u32 hwicap_type_1_write(u32 reg)
-{
-    return (XHI_TYPE_1 << XHI_TYPE_SHIFT) |
-        (reg << XHI_REGISTER_SHIFT) |
-        (XHI_OP_WRITE << XHI_OP_SHIFT);
-}
-
 #endif
@@ -0,0 +1,309 @@
+#include "hwicap-readback.h"
+#include "hwicap-fpga-fifo.h"
+
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/seq_file.h>
+#include <linux/stddef.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+/* Words of the buffer a readback is drained into */
+#define HWICAP_READBACK_WORDS (PAGE_SIZE / 4)
+
+static struct dentry *hwicap_readback_root;    /* debugfs directory of the driver */
+
+/* A running readback, one per open readback file */
+struct hwicap_readback {
+    struct hwicap_drvdata *drvdata;
+    u32 *buf;                   /* words drained from the read FIFO */
+    u32 left;                   /* words that are not read yet */
+};
+
+/**
+ * hwicap_readback_start - Send the readback command sequence to the ICAP.
+ * @drvdata: a pointer to the drvdata.
+ * @far: the frame address to start at.
+ * @words: the number of words to read.
+ *
+ * Returns: '0' on success and failure value on error
+ *
+ * The frame data follows in the read FIFO once it is read with
+ * get_configuration.
+ */
+static int hwicap_readback_start(struct hwicap_drvdata *drvdata, u32 far,
+        u32 words)
+{
+    const struct config_registers *regs = drvdata->config_regs;
+    u32 buffer[16];
+    u32 index = 0;
+
+    /*
+     * Create the data to be written to the ICAP.
+     */
+    buffer[index++] = XHI_DUMMY_PACKET;
+    buffer[index++] = XHI_SYNC_PACKET;
+    buffer[index++] = XHI_NOOP_PACKET;
+    buffer[index++] = hwicap_type_1_write(regs->CMD) | 1;
+    buffer[index++] = XHI_CMD_RCRC;
+    buffer[index++] = XHI_NOOP_PACKET;
+    buffer[index++] = XHI_NOOP_PACKET;
+    buffer[index++] = hwicap_type_1_write(regs->FAR) | 1;
+    buffer[index++] = far;
+    buffer[index++] = hwicap_type_1_write(regs->CMD) | 1;
+    buffer[index++] = XHI_CMD_RCFG;
+    buffer[index++] = XHI_NOOP_PACKET;
+    buffer[index++] = hwicap_type_1_read(regs->FDRO);
+    buffer[index++] = XHI_TYPE_2_READ | (words & XHI_TYPE2_CNT_MASK);
+    buffer[index++] = XHI_NOOP_PACKET;
+    buffer[index++] = XHI_NOOP_PACKET;
+
+    /*
+     * Write the data to the FIFO and initiate the transfer of data present
+     * in the FIFO to the ICAP device.
+     */
+    return drvdata->config->set_configuration(drvdata, &buffer[0], index);
+}
+
+/**
+ * hwicap_readback_open - Start a readback.
+ * @inode: the inode of the readback file.
+ * @file: the opened file.
+ */
+static int hwicap_readback_open(struct inode *inode, struct file *file)
+{
+    struct hwicap_drvdata *drvdata = inode->i_private;
+    struct hwicap_readback *rb;
+    u64 words;
+    int status;
+
+    words = ((u64) drvdata->readback_frames + XHI_PAD_FRAMES) * XHI_FRAME_WORDS;
+    if (!drvdata->readback_frames || words > XHI_TYPE2_CNT_MASK)
+        return -EINVAL;
+
+    rb = kzalloc(sizeof(*rb), GFP_KERNEL);
+    if (!rb)
+        return -ENOMEM;
+
+    rb->drvdata = drvdata;
+    rb->buf = (u32 *) __get_free_page(GFP_KERNEL);
+    if (!rb->buf) {
+        status = -ENOMEM;
+        goto failed1;
+    }
+
+    status = mutex_lock_interruptible(&drvdata->sem);
+    if (status)
+        goto failed2;
+
+    /* A load may be written in several parts, a readback must not come in between. */
+    if (drvdata->readback_active || drvdata->load_active) {
+        status = -EBUSY;
+        goto failed3;
+    }
+
+    drvdata->icap_idle = false;
+    status = hwicap_readback_start(drvdata, drvdata->readback_far, words);
+    if (status) {
+        drvdata->config->reset(drvdata);
+        goto failed3;
+    }
+
+    rb->left = words;
+    drvdata->readback_active = true;
+    mutex_unlock(&drvdata->sem);
+
+    file->private_data = rb;
+    return nonseekable_open(inode, file);
+
+ failed3:
+    mutex_unlock(&drvdata->sem);
+
+ failed2:
+    free_page((unsigned long)rb->buf);
+
+ failed1:
+    kfree(rb);
+
+    return status;
+}
+
+/**
+ * hwicap_readback_read - Read the next words of a readback.
+ * @file: the opened file.
+ * @ubuf: user space buffer.
+ * @count: size of ubuf.
+ * @ppos: file position.
+ *
+ * The words are drained from the read FIFO one page at a time and copied to
+ * user space. Only whole words are returned.
+ */
+static ssize_t hwicap_readback_read(struct file *file, char __user *ubuf,
+        size_t count, loff_t *ppos)
+{
+    struct hwicap_readback *rb = file->private_data;
+    struct hwicap_drvdata *drvdata = rb->drvdata;
+    ssize_t copied = 0;
+    u32 words;
+    int status;
+
+    status = mutex_lock_interruptible(&drvdata->sem);
+    if (status)
+        return status;
+
+    while (count >= 4 && rb->left > 0) {
+        words = min_t(size_t, count >> 2, HWICAP_READBACK_WORDS);
+        words = min(words, rb->left);
+
+        status = drvdata->config->get_configuration(drvdata, rb->buf, words);
+        if (status) {
+            status = -EIO;
+            break;
+        }
+        rb->left -= words;
+
+        if (copy_to_user(ubuf + copied, rb->buf, words << 2)) {
+            status = -EFAULT;
+            break;
+        }
+
+        copied += words << 2;
+        count  -= words << 2;
+    }
+
+    mutex_unlock(&drvdata->sem);
+
+    *ppos += copied;
+    return copied ? copied : status;
+}
+
+/**
+ * hwicap_readback_release - Finish or abort a readback.
+ * @inode: the inode of the readback file.
+ * @file: the opened file.
+ */
+static int hwicap_readback_release(struct inode *inode, struct file *file)
+{
+    struct hwicap_readback *rb = file->private_data;
+    struct hwicap_drvdata *drvdata = rb->drvdata;
+
+    mutex_lock(&drvdata->sem);
+
+    /* Throw away the words that were not read. */
+    if (rb->left > 0) {
+        fifo_icap_flush_fifo(drvdata);
+        drvdata->config->reset(drvdata);
+    }
+
+    if (hwicap_command_desync(drvdata))
+        pr_warn("hwicap: couldn't desync the ICAP after the readback\n");
+    else
+        drvdata->icap_idle = true;
+
+    drvdata->readback_active = false;
+    mutex_unlock(&drvdata->sem);
+
+    free_page((unsigned long)rb->buf);
+    kfree(rb);
+
+    return 0;
+}
+
+/* Configuration registers shown by the registers file */
+static const struct {
+    const char *name;
+    size_t offset;              /* offset of the register in struct config_registers */
+} hwicap_query_regs[] = {
+    { "STAT",    offsetof(struct config_registers, STAT) },
+    { "CRC",     offsetof(struct config_registers, CRC) },
+    { "BOOTSTS", offsetof(struct config_registers, BOOTSTS) },
+    { "IDCODE",  offsetof(struct config_registers, IDCODE) },
+    { "FAR",     offsetof(struct config_registers, FAR) },
+    { "COR",     offsetof(struct config_registers, COR) },
+    { "CTL",     offsetof(struct config_registers, CTL) },
+};
+
+/**
+ * hwicap_registers_show - Query the configuration registers.
+ * @m: the seq_file of the registers file.
+ * @unused: not used.
+ *
+ * All registers are queried in one ICAP transaction, then the ICAP is
+ * desynced again.
+ */
+static int hwicap_registers_show(struct seq_file *m, void *unused)
+{
+    struct hwicap_drvdata *drvdata = m->private;
+    u32 regs[ARRAY_SIZE(hwicap_query_regs)];
+    u32 values[ARRAY_SIZE(hwicap_query_regs)];
+    u32 i;
+    int status;
+
+    for (i = 0; i < ARRAY_SIZE(hwicap_query_regs); i++)
+        regs[i] = *(const u32 *)((const u8 *)drvdata->config_regs +
+                                 hwicap_query_regs[i].offset);
+
+    status = mutex_lock_interruptible(&drvdata->sem);
+    if (status)
+        return status;
+
+    if (drvdata->readback_active || drvdata->load_active) {
+        mutex_unlock(&drvdata->sem);
+        return -EBUSY;
+    }
+
+    drvdata->icap_idle = false;
+    status = hwicap_get_configuration_registers(drvdata, regs,
+            ARRAY_SIZE(regs), values);
+    if (status)
+        drvdata->config->reset(drvdata);
+    else if (!hwicap_command_desync(drvdata))
+        drvdata->icap_idle = true;
+
+    mutex_unlock(&drvdata->sem);
+
+    if (status)
+        return status;
+
+    for (i = 0; i < ARRAY_SIZE(hwicap_query_regs); i++)
+        seq_printf(m, "%-8s0x%08x\n", hwicap_query_regs[i].name, values[i]);
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(hwicap_registers);
+
+static const struct file_operations hwicap_readback_fops = {
+    .owner   = THIS_MODULE,
+    .open    = hwicap_readback_open,
+    .read    = hwicap_readback_read,
+    .release = hwicap_readback_release,
+    .llseek  = no_llseek,
+};
+
+void hwicap_readback_debugfs_init(void)
+{
+    hwicap_readback_root = debugfs_create_dir("hwicap_fpga_manager", NULL);
+}
+
+void hwicap_readback_debugfs_exit(void)
+{
+    debugfs_remove_recursive(hwicap_readback_root);
+}
+
+static void hwicap_readback_unregister(void *data)
+{
+    debugfs_remove_recursive(data);
+}
+
+int hwicap_readback_register(struct device *dev, struct hwicap_drvdata *drvdata)
+{
+    struct dentry *dir;
+
+    dir = debugfs_create_dir(dev_name(dev), hwicap_readback_root);
+    debugfs_create_x32("far", 0600, dir, &drvdata->readback_far);
+    debugfs_create_u32("frames", 0600, dir, &drvdata->readback_frames);
+    debugfs_create_file("readback", 0400, dir, drvdata, &hwicap_readback_fops);
+    debugfs_create_file("registers", 0400, dir, drvdata, &hwicap_registers_fops);
+
+    return devm_add_action_or_reset(dev, hwicap_readback_unregister, dir);
+}
@@ -0,0 +1,32 @@
+/*
+ * Configuration readback for the AXI HWICAP FPGA manager
+ *
+ * The frames starting at a frame address are read from the FDRO register of
+ * the ICAP and streamed to user space. The read FIFO of the HWICAP is drained
+ * in chunks of one page, the frames are never buffered as a whole.
+ *
+ * The readback is controlled through debugfs:
+ *   /sys/kernel/debug/hwicap_fpga_manager/<device>/far      frame address to start at
+ *   /sys/kernel/debug/hwicap_fpga_manager/<device>/frames   number of frames to read
+ *   /sys/kernel/debug/hwicap_fpga_manager/<device>/readback the read words
+ *   /sys/kernel/debug/hwicap_fpga_manager/<device>/registers STAT, CRC, BOOTSTS, ... of the ICAP
+ *
+ * Opening the readback file starts the readback, it is finished or aborted
+ * when the file is closed. No bitstream can be loaded in the meantime.
+ */
+#ifndef HWICAP_READBACK_H_    /* prevent circular inclusions */
+#define HWICAP_READBACK_H_    /* by using protection macros */
+
+#include <linux/types.h>
+#include <linux/platform_device.h>
+
+#include "hwicap-fpga.h"
+
+/* Create and remove the debugfs directory of the driver. */
+void hwicap_readback_debugfs_init(void);
+void hwicap_readback_debugfs_exit(void);
+
+/* Create the debugfs files of a device, they are removed when the device is unbound. */
+int hwicap_readback_register(struct device *dev, struct hwicap_drvdata *drvdata);
+
+#endif